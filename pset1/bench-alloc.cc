@@ -0,0 +1,275 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Usage: ./bench-alloc [-n NOPS] [-j THREADS] [-w WORKLOAD] [-a ALLOCATOR]
+//    Compare m61_malloc/m61_free with the system malloc/free on synthetic
+//    traces:
+//      uniform    random churn over 4096 slots of 1-512 byte blocks
+//      powerlaw   random churn over 4096 slots, sizes Pareto-distributed
+//                 from 8 bytes to 64 KiB (mostly small, a few large)
+//      prodcons   one thread allocates, another frees (cross-thread frees)
+//      threads    THREADS threads, each running `uniform` privately
+//    For each trace and allocator, report throughput, latency percentiles
+//    (one operation in 16 is timed; timer overhead is included), peak RSS,
+//    and memory overhead (peak RSS growth / peak live bytes). The m61 runs
+//    also report external fragmentation from `m61_get_statistics`, taken
+//    before the final frees. Each run happens in its own process, so RSS
+//    is not shared between runs.
+//    WORKLOAD and ALLOCATOR restrict the runs (`m61` or `system`).
+
+struct allocator {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*free)(void*);
+};
+
+static const allocator allocators[] = {
+    {"m61", [] (size_t sz) { return m61_malloc(sz); }, [] (void* ptr) { m61_free(ptr); }},
+    {"system", malloc, free}
+};
+
+// One thread's measurements
+struct recorder {
+    std::vector<uint32_t> latency;      // sampled op latencies in ns
+    size_t nsamples = 0;
+    size_t nops = 0;
+    long long live = 0;                 // live bytes
+    long long peak_live = 0;
+    double frag = -1;                   // m61 fragmentation at end
+
+    template <typename F>
+    inline void op(F f) {
+        if (this->nops++ % 16 == 0) {
+            auto t0 = std::chrono::steady_clock::now();
+            f();
+            auto t1 = std::chrono::steady_clock::now();
+            if (this->nsamples < this->latency.size()) {
+                this->latency[this->nsamples++] =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            }
+        } else {
+            f();
+        }
+    }
+    void note_alloc(size_t sz) {
+        this->live += sz;
+        this->peak_live = std::max(this->peak_live, this->live);
+    }
+    void note_free(size_t sz) {
+        this->live -= sz;
+    }
+};
+
+// churn(a, r, nops, nslots, size, seed)
+//    Perform `nops` operations on `nslots` slots: an empty slot is filled
+//    with a block of `size(randomness)` bytes, a full one is freed.
+template <typename SizeF>
+static void churn(const allocator& a, recorder& r, size_t nops, size_t nslots,
+                  SizeF size, unsigned seed) {
+    std::minstd_rand randomness(seed);
+    std::vector<void*> ptrs(nslots, nullptr);
+    std::vector<size_t> sizes(nslots, 0);
+    for (size_t i = 0; i != nops; ++i) {
+        size_t slot = uniform_int(size_t(0), nslots - 1, randomness);
+        if (ptrs[slot]) {
+            r.op([&] { a.free(ptrs[slot]); });
+            r.note_free(sizes[slot]);
+            ptrs[slot] = nullptr;
+        } else {
+            size_t sz = size(randomness);
+            r.op([&] { ptrs[slot] = a.alloc(sz); });
+            assert(ptrs[slot]);
+            memset(ptrs[slot], 0, std::min(sz, size_t(64)));
+            sizes[slot] = sz;
+            r.note_alloc(sz);
+        }
+    }
+    if (&a == &allocators[0]) {
+        r.frag = m61_get_statistics().fragmentation;
+    }
+    for (size_t slot = 0; slot != nslots; ++slot) {
+        a.free(ptrs[slot]);
+    }
+}
+
+static size_t uniform_size(std::minstd_rand& randomness) {
+    return uniform_int(size_t(1), size_t(512), randomness);
+}
+
+static size_t powerlaw_size(std::minstd_rand& randomness) {
+    // Pareto with shape 1.2, minimum 8, truncated at 64 KiB
+    double u = std::uniform_real_distribution<double>(0, 1)(randomness);
+    double sz = 8 / std::pow(1 - u, 1 / 1.2);
+    return std::min(size_t(sz), size_t(64) << 10);
+}
+
+// prodcons(a, producer, consumer, nops)
+//    The producer allocates `nops / 2` blocks and passes them to the
+//    consumer, which frees them, through a bounded single-producer
+//    single-consumer queue.
+static void prodcons(const allocator& a, recorder& producer, recorder& consumer,
+                     size_t nops) {
+    constexpr size_t qsize = 1024;
+    struct slot {
+        void* ptr;
+        size_t sz;
+    };
+    std::vector<slot> q(qsize);
+    std::atomic<size_t> head = 0, tail = 0;
+    std::atomic<long long> live = 0;
+    size_t n = nops / 2;
+
+    std::thread cons([&] {
+        for (size_t i = 0; i != n; ++i) {
+            size_t h = head.load(std::memory_order_relaxed);
+            while (tail.load(std::memory_order_acquire) == h) {
+                std::this_thread::yield();
+            }
+            slot s = q[h % qsize];
+            head.store(h + 1, std::memory_order_release);
+            consumer.op([&] { a.free(s.ptr); });
+            live -= s.sz;
+        }
+    });
+    std::minstd_rand randomness(1);
+    for (size_t i = 0; i != n; ++i) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == qsize) {
+            std::this_thread::yield();
+        }
+        size_t sz = uniform_size(randomness);
+        void* ptr;
+        producer.op([&] { ptr = a.alloc(sz); });
+        assert(ptr);
+        q[t % qsize] = {ptr, sz};
+        tail.store(t + 1, std::memory_order_release);
+        producer.peak_live = std::max(producer.peak_live, live += sz);
+    }
+    cons.join();
+}
+
+static const char* const workloads[] = {"uniform", "powerlaw", "prodcons", "threads"};
+
+// run(workload, a, nops, nthreads)
+//    Run one trace and print one line of results. Called in a child
+//    process.
+static void run(const char* workload, const allocator& a, size_t nops,
+                unsigned nthreads) {
+    std::vector<recorder> rs(std::max(nthreads, 2U));
+    for (auto& r : rs) {
+        // Sample buffers are filled (so their pages are resident) before
+        // the baseline RSS is taken
+        r.latency.assign(nops / 16 + 1, 0);
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    long base_rss = ru.ru_maxrss;
+    auto start = std::chrono::steady_clock::now();
+    if (strcmp(workload, "uniform") == 0) {
+        churn(a, rs[0], nops, 4096, uniform_size, 1);
+    } else if (strcmp(workload, "powerlaw") == 0) {
+        churn(a, rs[0], nops, 4096, powerlaw_size, 1);
+    } else if (strcmp(workload, "prodcons") == 0) {
+        prodcons(a, rs[0], rs[1], nops);
+    } else {
+        std::vector<std::thread> th;
+        for (unsigned i = 0; i != nthreads; ++i) {
+            th.emplace_back([&, i] {
+                churn(a, rs[i], nops / nthreads, 4096, uniform_size, i + 1);
+            });
+        }
+        for (auto& t : th) {
+            t.join();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<uint32_t> lat;
+    size_t total = 0;
+    long long peak_live = 0;
+    for (auto& r : rs) {
+        lat.insert(lat.end(), r.latency.begin(), r.latency.begin() + r.nsamples);
+        total += r.nops;
+        peak_live += r.peak_live;
+    }
+    auto pct = [&] (double p) -> unsigned {
+        if (lat.empty()) {
+            return 0;
+        }
+        auto it = lat.begin() + size_t(p * (lat.size() - 1));
+        std::nth_element(lat.begin(), it, lat.end());
+        return *it;
+    };
+    getrusage(RUSAGE_SELF, &ru);
+    double rss = ru.ru_maxrss * 1024.0;
+    double growth = (ru.ru_maxrss - base_rss) * 1024.0;
+
+    printf("%-9s %-7s %12.0f %7u %7u %7u %8.1f MiB %8.2fx",
+           workload, a.name, total / elapsed.count(), pct(0.5), pct(0.99), pct(0.999),
+           rss / (1 << 20), peak_live ? growth / peak_live : 0.0);
+    if (rs[0].frag >= 0) {
+        printf(" %6.1f%%\n", 100 * rs[0].frag);
+    } else {
+        printf("      -\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t nops = 4'000'000;
+    unsigned nthreads = std::max(std::thread::hardware_concurrency(), 2U);
+    const char* only_workload = nullptr;
+    const char* only_allocator = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:w:a:")) != -1) {
+        if (opt == 'n') {
+            nops = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'j') {
+            nthreads = std::max(strtoul(optarg, nullptr, 0), 1UL);
+        } else if (opt == 'w') {
+            only_workload = optarg;
+        } else if (opt == 'a') {
+            only_allocator = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-n NOPS] [-j THREADS] [-w WORKLOAD] [-a ALLOCATOR]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    printf("%-9s %-7s %12s %7s %7s %7s %12s %9s %7s\n",
+           "workload", "alloc", "ops/sec", "p50 ns", "p99 ns", "p999 ns",
+           "peak RSS", "overhead", "frag");
+    for (const char* w : workloads) {
+        if (only_workload && strcmp(w, only_workload) != 0) {
+            continue;
+        }
+        for (const allocator& a : allocators) {
+            if (only_allocator && strcmp(a.name, only_allocator) != 0) {
+                continue;
+            }
+            fflush(stdout);
+            pid_t p = fork();
+            if (p == 0) {
+                run(w, a, nops, nthreads);
+                fflush(stdout);
+                _exit(0);
+            }
+            int status;
+            waitpid(p, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "%s/%s: run failed\n", w, a.name);
+            }
+        }
+    }
+}
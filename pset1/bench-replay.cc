@@ -0,0 +1,196 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Usage: ./bench-replay [-a ALLOCATOR] TRACEFILE
+//    Replay an allocation trace recorded with `M61_TRACE=TRACEFILE` against
+//    m61 (the default) or the system allocator (`-a system`), and report
+//    elapsed time, throughput, and peak RSS. The m61 replay passes each
+//    call's recorded file:line, so the heap reports match the original
+//    run. All threads' events are replayed by one thread in time order.
+//    A realloc is replayed at its `time`, but its new pointer id becomes
+//    live only at its `end_time`, so a free of the same id by another
+//    thread in between applies to the earlier block with that id.
+//    Each pointer id maps to the pointer returned during the replay;
+//    events naming ids that are not live in the replay (for instance,
+//    frees of blocks allocated before tracing began) are skipped and
+//    counted.
+
+struct allocator {
+    const char* name;
+    void* (*malloc)(size_t, const char*, int);
+    void (*free)(void*, const char*, int);
+    void* (*calloc)(size_t, size_t, const char*, int);
+    void* (*realloc)(void*, size_t, const char*, int);
+    void* (*aligned_alloc)(size_t, size_t, const char*, int);
+};
+
+static const allocator allocators[] = {
+    {"m61", m61_malloc, m61_free, m61_calloc, m61_realloc, m61_aligned_alloc},
+    {"system",
+     [] (size_t sz, const char*, int) { return malloc(sz); },
+     [] (void* ptr, const char*, int) { free(ptr); },
+     [] (size_t count, size_t sz, const char*, int) { return calloc(count, sz); },
+     [] (void* ptr, size_t sz, const char*, int) { return realloc(ptr, sz); },
+     [] (size_t align, size_t sz, const char*, int) {
+         void* ptr;
+         return posix_memalign(&ptr, std::max(align, sizeof(void*)), sz) == 0 ? ptr : nullptr;
+     }}
+};
+
+// Marks the point in the replay where a realloc's new id becomes live
+static constexpr uint8_t realloc_done = 0xFF;
+
+struct site {
+    const char* file = "?";
+    int line = 0;
+};
+
+int main(int argc, char* argv[]) {
+    const allocator* a = &allocators[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "a:")) != -1) {
+        if (opt == 'a' && strcmp(optarg, "m61") == 0) {
+            a = &allocators[0];
+        } else if (opt == 'a' && strcmp(optarg, "system") == 0) {
+            a = &allocators[1];
+        } else {
+            fprintf(stderr, "Usage: %s [-a m61|system] TRACEFILE\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Usage: %s [-a m61|system] TRACEFILE\n", argv[0]);
+        exit(1);
+    }
+    FILE* f = fopen(argv[optind], "r");
+    if (!f) {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    // Read the trace, collecting site descriptions
+    std::vector<m61_trace_record> events;
+    size_t ncalls = 0;
+    std::vector<site> sites;
+    std::deque<std::string> files;      // site names; must not move
+    m61_trace_record r;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.op == M61_TRACE_SITE) {
+            std::string file((r.arg + 7) & ~7, '\0');
+            if (fread(file.data(), 1, file.size(), f) != file.size()) {
+                break;
+            }
+            file.resize(r.arg);
+            files.push_back(std::move(file));
+            if (r.site >= sites.size()) {
+                sites.resize(r.site + 1);
+            }
+            sites[r.site] = {files.back().c_str(), int(r.size)};
+        } else if (r.op >= M61_TRACE_MALLOC && r.op <= M61_TRACE_ALIGNED_ALLOC) {
+            events.push_back(r);
+            ++ncalls;
+            if (r.op == M61_TRACE_REALLOC) {
+                r.op = realloc_done;
+                r.time = r.end_time;
+                events.push_back(r);
+            }
+        } else {
+            fprintf(stderr, "%s: bad trace record\n", argv[optind]);
+            exit(1);
+        }
+    }
+    fclose(f);
+    std::stable_sort(events.begin(), events.end(),
+                     [] (const m61_trace_record& x, const m61_trace_record& y) {
+                         return x.time < y.time;
+                     });
+
+    std::unordered_map<uint64_t, void*> live;
+    live.reserve(events.size());
+    std::unordered_map<uint64_t, void*> pending;    // reallocs not yet done
+    size_t skipped = 0;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    long base_rss = ru.ru_maxrss;
+    auto start = std::chrono::steady_clock::now();
+    for (const m61_trace_record& e : events) {
+        if (e.op == realloc_done) {
+            auto it = pending.find(e.ptr);
+            if (it != pending.end()) {
+                live[e.ptr] = it->second;
+                pending.erase(it);
+            }
+            continue;
+        }
+        site s = e.site < sites.size() ? sites[e.site] : site();
+        void* ptr = nullptr;
+        if (e.op == M61_TRACE_FREE || e.op == M61_TRACE_REALLOC) {
+            uint64_t id = e.op == M61_TRACE_FREE ? e.ptr : e.arg;
+            if (id) {
+                auto it = live.find(id);
+                if (it == live.end()) {
+                    ++skipped;
+                    continue;
+                }
+                ptr = it->second;
+                live.erase(it);
+            }
+        }
+        void* result;
+        uint64_t id = e.ptr;
+        if (e.op == M61_TRACE_FREE) {
+            a->free(ptr, s.file, s.line);
+            continue;
+        } else if (e.op == M61_TRACE_MALLOC) {
+            result = a->malloc(e.size, s.file, s.line);
+        } else if (e.op == M61_TRACE_CALLOC) {
+            result = a->calloc(e.arg, e.size, s.file, s.line);
+        } else if (e.op == M61_TRACE_REALLOC) {
+            result = a->realloc(ptr, e.size, s.file, s.line);
+            if (e.size != 0 && (!result || !id)) {
+                // A failed realloc leaves the old block allocated
+                id = e.arg;
+                result = result ? result : ptr;
+            } else if (id && result) {
+                pending[id] = result;
+                continue;
+            }
+        } else {
+            result = a->aligned_alloc(e.arg, e.size, s.file, s.line);
+        }
+        if (id && result) {
+            live[id] = result;
+        } else if (result) {
+            // The traced call failed, so the program never used a block
+            a->free(result, s.file, s.line);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("%s: %zu events from %zu sites, %.3f s, %.0f ops/sec, peak RSS %.1f MiB (+%.1f MiB)\n",
+           a->name, ncalls, sites.size(), elapsed.count(),
+           ncalls / elapsed.count(), ru.ru_maxrss / 1024.0,
+           (ru.ru_maxrss - base_rss) / 1024.0);
+    if (skipped) {
+        printf("%zu events skipped (pointer id not live)\n", skipped);
+    }
+    if (a == &allocators[0]) {
+        m61_print_statistics();
+    }
+    for (auto& [id, ptr] : live) {
+        a->free(ptr, "bench-replay.cc", 0);
+    }
+    for (auto& [id, ptr] : pending) {
+        a->free(ptr, "bench-replay.cc", 0);
+    }
+}
@@ -0,0 +1,69 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Usage: ./bench-threads [-j MAXTHREADS] [-n NOPS]
+//    Measure m61_malloc/m61_free throughput with 1, 2, 4, ..., MAXTHREADS
+//    threads. Each thread performs NOPS operations on a private working
+//    set of up to 64 blocks of 1-512 bytes. With per-thread caches,
+//    throughput should scale nearly linearly up to the number of cores.
+
+static void churn_thread(size_t nops, unsigned seed) {
+    std::minstd_rand randomness(seed);
+    void* ptrs[64] = {};
+    for (size_t i = 0; i != nops; ++i) {
+        unsigned slot = uniform_int(0U, 63U, randomness);
+        if (ptrs[slot]) {
+            m61_free(ptrs[slot]);
+            ptrs[slot] = nullptr;
+        } else {
+            ptrs[slot] = m61_malloc(uniform_int(size_t(1), size_t(512), randomness));
+            assert(ptrs[slot]);
+        }
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned maxthreads = std::max(std::thread::hardware_concurrency(), 1U);
+    size_t nops = 2'000'000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:n:")) != -1) {
+        if (opt == 'j') {
+            maxthreads = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'n') {
+            nops = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: %s [-j MAXTHREADS] [-n NOPS]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    double base_rate = 0;
+    for (unsigned nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> th;
+        for (unsigned i = 0; i != nthreads; ++i) {
+            th.emplace_back(churn_thread, nops, i + 1);
+        }
+        for (auto& t : th) {
+            t.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double rate = nops * nthreads / elapsed.count();
+        if (nthreads == 1) {
+            base_rate = rate;
+        }
+        printf("%3u %s: %12.0f ops/sec  %6.2fx speedup  %4.0f%% efficiency\n",
+               nthreads, nthreads == 1 ? "thread " : "threads", rate,
+               rate / base_rate, 100 * rate / (base_rate * nthreads));
+    }
+    m61_print_statistics();
+}
@@ -0,0 +1,217 @@
+#include "m61.hh"
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+
+// libm61.so
+//    The m61 allocator as a drop-in replacement for the C library's
+//    allocator, for running unmodified programs on m61:
+//
+//        LD_PRELOAD=/path/to/pset1/libm61.so ./program
+//
+//    The functions below replace `malloc`, `free`, and friends, and the
+//    C++ `operator new` and `operator delete`. Allocations are charged to
+//    the replacement function's location in this file, so reports group
+//    them by entry point. Environment variables such as `M61_TRACE` work
+//    as usual. Each function with C linkage must replace its C library
+//    counterpart, since the C library's versions cannot handle m61
+//    pointers. The library also registers `pthread_atfork` handlers so
+//    a multithreaded program can fork safely.
+
+extern "C" {
+
+void* malloc(size_t sz) {
+    void* ptr = m61_malloc(sz);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void free(void* ptr) {
+    m61_free(ptr);
+}
+
+void* calloc(size_t count, size_t sz) {
+    void* ptr = m61_calloc(count, sz);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t sz) {
+    void* newptr = m61_realloc(ptr, sz);
+    if (!newptr && sz != 0) {
+        errno = ENOMEM;
+    }
+    return newptr;
+}
+
+void* reallocarray(void* ptr, size_t count, size_t sz) {
+    size_t total;
+    if (__builtin_mul_overflow(count, sz, &total)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, total);
+}
+
+int posix_memalign(void** ptr, size_t align, size_t sz) {
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    void* p = m61_aligned_alloc(align, sz);
+    if (!p) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t align, size_t sz) {
+    void* ptr = m61_aligned_alloc(align, sz);
+    if (!ptr) {
+        errno = align && (align & (align - 1)) == 0 ? ENOMEM : EINVAL;
+    }
+    return ptr;
+}
+
+void* memalign(size_t align, size_t sz) {
+    return aligned_alloc(align, sz);
+}
+
+void* valloc(size_t sz) {
+    return aligned_alloc(sysconf(_SC_PAGESIZE), sz);
+}
+
+void* pvalloc(size_t sz) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(pagesize, (sz + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    return m61_usable_size(ptr);
+}
+
+}
+
+
+// new_alloc(sz, align)
+//    Allocate memory for `operator new`, calling the new handler until
+//    allocation succeeds. Throws `std::bad_alloc` if there is no handler.
+static void* new_alloc(size_t sz, size_t align) {
+    while (true) {
+        void* ptr;
+        if (align <= alignof(std::max_align_t)) {
+            ptr = m61_malloc(sz);
+        } else {
+            ptr = m61_aligned_alloc(align, sz);
+        }
+        if (ptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+// new_alloc_nothrow(sz, align)
+//    Same, but return `nullptr` rather than throwing.
+static void* new_alloc_nothrow(size_t sz, size_t align) noexcept {
+    try {
+        return new_alloc(sz, align);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t sz) {
+    return new_alloc(sz, 0);
+}
+
+void* operator new[](size_t sz) {
+    return new_alloc(sz, 0);
+}
+
+void* operator new(size_t sz, std::align_val_t align) {
+    return new_alloc(sz, size_t(align));
+}
+
+void* operator new[](size_t sz, std::align_val_t align) {
+    return new_alloc(sz, size_t(align));
+}
+
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    return new_alloc_nothrow(sz, 0);
+}
+
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    return new_alloc_nothrow(sz, 0);
+}
+
+void* operator new(size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return new_alloc_nothrow(sz, size_t(align));
+}
+
+void* operator new[](size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return new_alloc_nothrow(sz, size_t(align));
+}
+
+void operator delete(void* ptr) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    m61_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    m61_free(ptr);
+}
+
+
+__attribute__((constructor)) static void register_fork_handlers() {
+    pthread_atfork(m61_fork_prepare, m61_fork_parent, m61_fork_child);
+}
@@ -3,38 +3,2097 @@
 #include <cstddef>
 #include <cstring>
 #include <cstdio>
+#include <cerrno>
 #include <cinttypes>
 #include <cassert>
+#include <cmath>
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sched.h>
 
 
+// m61_memory_buffer
+//    A region of memory obtained from the OS with `mmap`. The heap is a
+//    list of buffers: a new one is mapped whenever no free block is big
+//    enough, and a buffer whose blocks have all been freed and coalesced
+//    is returned to the OS. Every buffer is `m61_buffer_size` bytes and
+//    aligned to that size, so the buffer holding any block is found by
+//    masking the block's address. The buffer descriptor lives at the start
+//    of its own mapping, followed by the buffer's side and state tables.
 struct m61_memory_buffer {
-    char* buffer;
-    size_t pos = 0;
-    size_t size = 8 << 20; /* 8 MiB */
+    char* buffer;                // first usable byte
+    size_t size;                 // # usable bytes
+    size_t mapsize;              // # bytes mapped, including descriptor
+    m61_memory_buffer* prev = nullptr;
+    m61_memory_buffer* next = nullptr;
 
-    m61_memory_buffer();
-    ~m61_memory_buffer();
+    static m61_memory_buffer* create(bool huge_pages);
+    void destroy();
 };
 
-static m61_memory_buffer default_buffer;
+static constexpr size_t m61_buffer_size = 8 << 20;      /* 8 MiB */
+static constexpr size_t m61_buffer_descriptor_size = 64;
+static_assert(sizeof(m61_memory_buffer) <= m61_buffer_descriptor_size,
+              "m61_memory_buffer descriptor too large");
 
+// Buffers are aligned to their size, so also to huge pages
+static constexpr size_t m61_huge_page_size = 2 << 20;   /* 2 MiB */
+static_assert(m61_buffer_size % m61_huge_page_size == 0,
+              "m61_buffer_size must be a multiple of m61_huge_page_size");
 
-m61_memory_buffer::m61_memory_buffer() {
-    void* buf = mmap(nullptr,    // Place the buffer at a random address
-        this->size,              // Buffer should be 8 MiB big
+// Side table
+//    Per-block metadata kept out of line, in an array after the buffer
+//    descriptor with one entry per 32 bytes of buffer (no two blocks start
+//    in the same 32 bytes). Every allocation writes its block's entry: the
+//    allocating thread's remote-free queue id in the top 8 bits (see
+//    `remote_free`), and the block's allocation site id in the low 24,
+//    which is meaningful only if the block's tag has `M61_SITE`.
+static constexpr size_t m61_side_granule = 32;
+static constexpr size_t m61_side_table_size =
+    m61_buffer_size / m61_side_granule * sizeof(uint32_t);
+static constexpr unsigned m61_side_owner_shift = 24;
+static constexpr uint32_t m61_side_site_mask = (uint32_t(1) << m61_side_owner_shift) - 1;
+
+// State table
+//    One byte per 16 bytes of buffer, recording whether a payload starts
+//    there and whether it is live or has been freed. `m61_free` checks a
+//    pointer against it in O(1); a live block's payload is the only
+//    address in the block marked `M61_STATE_LIVE`. Each byte is written
+//    only by the thread that owns the block, but heap scans and invalid-free
+//    diagnosis read bytes of blocks other threads own, so every access is
+//    atomic (see `load_state`).
+static constexpr size_t m61_state_granule = 16;
+static constexpr size_t m61_state_table_size = m61_buffer_size / m61_state_granule;
+static constexpr uint8_t M61_STATE_LIVE = 1;
+static constexpr uint8_t M61_STATE_FREED = 2;
+
+static constexpr size_t m61_buffer_header_size =
+    m61_buffer_descriptor_size + m61_side_table_size + m61_state_table_size;
+
+static inline m61_memory_buffer* buffer_of(const void* ptr) {
+    return reinterpret_cast<m61_memory_buffer*>(
+        reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(m61_buffer_size - 1)
+    );
+}
+
+static inline uint32_t* side_entry(const void* ptr) {
+    m61_memory_buffer* b = buffer_of(ptr);
+    uintptr_t off = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(b);
+    return reinterpret_cast<uint32_t*>(
+        reinterpret_cast<char*>(b) + m61_buffer_descriptor_size
+    ) + off / m61_side_granule;
+}
+
+static inline uint8_t* state_entry(const void* ptr) {
+    m61_memory_buffer* b = buffer_of(ptr);
+    uintptr_t off = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(b);
+    return reinterpret_cast<uint8_t*>(b) + m61_buffer_descriptor_size
+        + m61_side_table_size + off / m61_state_granule;
+}
+
+// load_state(st), store_state(st, state)
+//    Read or write state table entry `st` (from `state_entry`).
+static inline uint8_t load_state(const uint8_t* st) {
+    return __atomic_load_n(st, __ATOMIC_RELAXED);
+}
+
+static inline void store_state(uint8_t* st, uint8_t state) {
+    __atomic_store_n(st, state, __ATOMIC_RELAXED);
+}
+
+
+// m61_memory_buffer::create(huge_pages)
+//    Map a new buffer, asking for transparent huge pages if `huge_pages`.
+//    Returns `nullptr` if the OS is out of memory.
+m61_memory_buffer* m61_memory_buffer::create(bool huge_pages) {
+    // Map twice the size, then trim to an aligned buffer
+    void* map = mmap(nullptr,    // Place the buffer at a random address
+        2 * m61_buffer_size,     // Room for an aligned buffer
         PROT_WRITE,              // We want to read and write the buffer
         MAP_ANON | MAP_PRIVATE, -1, 0);
                                  // We want memory freshly allocated by the OS
-    assert(buf != MAP_FAILED);
-    this->buffer = (char*) buf;
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    char* buf = reinterpret_cast<char*>(buffer_of(
+        reinterpret_cast<char*>(map) + m61_buffer_size - 1
+    ));
+    char* mapend = reinterpret_cast<char*>(map) + 2 * m61_buffer_size;
+    if (buf != map) {
+        munmap(map, buf - reinterpret_cast<char*>(map));
+    }
+    if (buf + m61_buffer_size != mapend) {
+        munmap(buf + m61_buffer_size, mapend - (buf + m61_buffer_size));
+    }
+    if (huge_pages) {
+        // Fails harmlessly if the kernel lacks THP
+        madvise(buf, m61_buffer_size, MADV_HUGEPAGE);
+    }
+
+    m61_memory_buffer* b = new (buf) m61_memory_buffer;
+    // Blocks start 8 bytes before a 16-byte boundary; see `m61_header`
+    b->buffer = buf + m61_buffer_header_size + 8;
+    b->size = m61_buffer_size - m61_buffer_header_size - 8;
+    b->mapsize = m61_buffer_size;
+    return b;
+}
+
+// m61_memory_buffer::destroy()
+//    Return this buffer to the OS.
+void m61_memory_buffer::destroy() {
+    munmap(this, this->mapsize);
+}
+
+
+struct m61_site;
+
+// m61_header
+//    Every block starts with an 8-byte header, `tag`, placed just before
+//    a 16-byte boundary so the payload is aligned. The tag holds flag bits,
+//    the block size (a multiple of 16, including the header), and the
+//    block's slack: the number of bytes by which its capacity exceeds the
+//    requested size, so the requested size needs no separate word. A free
+//    block also stores its size in its last 8 bytes (a boundary tag), so
+//    m61_free can find a free predecessor, and merge with it, in O(1).
+//    Anything else we know about a buffer block lives out of line, in the
+//    side table, whose entry every allocation writes; `M61_SITE` says
+//    whether the block has a site (when sampling, most do not), and so
+//    whether the entry's site id is valid.
+struct m61_header {
+    size_t tag;                  // slack | block size | flags
+};
+static_assert(sizeof(m61_header) + 8 == alignof(std::max_align_t),
+              "m61_header must preserve payload alignment");
+
+static constexpr size_t M61_INUSE = 1;          // block is allocated
+static constexpr size_t M61_PREV_INUSE = 2;     // previous block is allocated
+static constexpr size_t M61_FIRST = 4;          // block starts its buffer
+static constexpr size_t M61_MMAPPED = 8;        // block has its own mapping
+static constexpr size_t M61_FLAGS = 15;
+static constexpr size_t M61_SIZE_MASK = ((size_t(1) << 48) - 1) & ~M61_FLAGS;
+static constexpr unsigned M61_SLACK_SHIFT = 48;
+static constexpr size_t M61_MAX_SLACK = (size_t(1) << 15) - 1;
+static constexpr size_t M61_SITE = size_t(1) << 63;   // block has a site
+
+// m61_free_block
+//    A free block. The links live in the (unused) payload. Bins are doubly
+//    linked so a block can be removed in O(1) when a neighbor merges with
+//    it; thread caches use only `next`.
+struct m61_free_block {
+    m61_header hdr;
+    m61_free_block* next;
+    m61_free_block* prev;
+};
+
+// Smallest block: header, links, and boundary tag
+static constexpr size_t m61_min_block = sizeof(m61_free_block) + 8;
+static_assert(m61_min_block % 16 == 0, "m61_min_block must be a multiple of 16");
+
+// Largest block that fits in a buffer, with the closing fencepost header
+static constexpr size_t m61_max_buffer_block =
+    (m61_buffer_size - m61_buffer_header_size - 16) & ~size_t(15);
+
+// load_tag(hdr)
+//    Return `hdr`'s tag. Use this to read a block that another thread may
+//    own: the owner updates the tag's flag bits with atomic
+//    read-modify-writes (see `finish_alloc`), so the read must be atomic
+//    too.
+static inline size_t load_tag(const m61_header* hdr) {
+    return __atomic_load_n(&hdr->tag, __ATOMIC_RELAXED);
+}
+
+static inline size_t block_size(const m61_header* hdr) {
+    return load_tag(hdr) & M61_SIZE_MASK;
+}
+
+static inline m61_header* next_block(m61_header* hdr) {
+    return reinterpret_cast<m61_header*>(
+        reinterpret_cast<char*>(hdr) + block_size(hdr)
+    );
+}
+
+static inline void set_boundary_tag(m61_header* hdr) {
+    reinterpret_cast<size_t*>(next_block(hdr))[-1] = block_size(hdr);
+}
+
+// set_prev_inuse(hdr, inuse)
+//    Set `hdr`'s `M61_PREV_INUSE` flag to `inuse`. Called with `heap_lock`
+//    held, but `hdr` may be a live block whose owning thread is updating
+//    the tag's other bits without the lock (see `finish_alloc`), so both
+//    sides use atomic read-modify-writes.
+static inline void set_prev_inuse(m61_header* hdr, bool inuse) {
+    if (inuse) {
+        __atomic_fetch_or(&hdr->tag, M61_PREV_INUSE, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&hdr->tag, ~M61_PREV_INUSE, __ATOMIC_RELAXED);
+    }
+}
+
+// Size classes
+//    Sizes 1-128 are rounded up to a multiple of 16. Larger sizes are
+//    rounded up to one of four classes per power of two (160, 192, 224,
+//    256, 320, ...), so internal fragmentation is at most 25%.
+static constexpr unsigned m61_nclasses = 8 + 4 * (47 - 7 + 1);
+static constexpr size_t m61_max_size = size_t(1) << 47;
+
+static constexpr unsigned m61_size_class(size_t sz) {
+    if (sz <= 128) {
+        return sz <= 16 ? 0 : (sz - 1) / 16;
+    }
+    unsigned lg = 63 - __builtin_clzl(sz - 1);
+    return 8 + (lg - 7) * 4 + (((sz - 1) >> (lg - 2)) & 3);
+}
+
+static constexpr size_t m61_class_size(unsigned sclass) {
+    if (sclass < 8) {
+        return (sclass + 1) * 16;
+    }
+    unsigned lg = (sclass - 8) / 4 + 7;
+    return (size_t(1) << lg) + ((sclass - 8) % 4 + 1) * (size_t(1) << (lg - 2));
+}
+
+// m61_size_class_floor(sz)
+//    Return the largest size class no bigger than `sz`. Requires `sz >= 16`.
+static inline unsigned m61_size_class_floor(size_t sz) {
+    unsigned sclass = m61_size_class(sz);
+    return m61_class_size(sclass) > sz ? sclass - 1 : sclass;
+}
+
+// heap_lock
+//    Protects the central heap: the buffer list, the bins, and the heap
+//    statistics. Most allocations never take it; see `m61_tcache` below.
+static std::mutex heap_lock;
+
+// options
+//    Tuning knobs, read from the environment when the heap is first used.
+//    `M61_COALESCE=0` turns off coalescing of free neighbors (which makes
+//    the effect of fragmentation easy to observe).
+//    `M61_MMAP_THRESHOLD=N` sends requests of N or more bytes (default
+//    128 KiB) to their own mappings; see `large_alloc`.
+//    `M61_SAMPLE_INTERVAL=N` records the allocation site of only about one
+//    allocation per N bytes allocated; see `sample_alloc`. The default, 0,
+//    records every site.
+//    `M61_LAZY_CANARIES=1` checks block canaries only in heap scans rather
+//    than on every free; see `check_canary`.
+//    `M61_QUARANTINE=N` holds up to N bytes of freed blocks back from reuse
+//    to catch writes after free; see `quarantine_locked`. Debug builds only.
+//    `M61_TRACE=FILE` writes a trace of allocation calls to FILE; see
+//    `trace_event`.
+//    `M61_HUGE_PAGES=1` asks for transparent huge pages for buffers and
+//    for large blocks of 2 MiB or more, which are then 2 MiB aligned; see
+//    `m61_get_statistics` for the resulting coverage.
+static constinit struct {
+    std::atomic<bool> initialized;
+    bool coalesce;
+    bool lazy_canaries;
+    bool huge_pages;
+    size_t mmap_threshold;
+    size_t sample_interval;
+    size_t quarantine;
+    bool trace;
+    int trace_fd;
+    uint64_t trace_start;        // `trace_now()` when tracing began
+} options = {};
+
+// trace_now()
+//    Return the time in nanoseconds from a monotonic clock.
+static inline uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool env_flag(const char* name, bool dflt) {
+    const char* val = getenv(name);
+    return val && *val ? strcmp(val, "0") != 0 : dflt;
+}
+
+static size_t env_size(const char* name, size_t dflt) {
+    const char* val = getenv(name);
+    return val && *val ? strtoull(val, nullptr, 0) : dflt;
+}
+
+static void options_init_locked() {
+    options.coalesce = env_flag("M61_COALESCE", true);
+    options.lazy_canaries = env_flag("M61_LAZY_CANARIES", false);
+    options.huge_pages = env_flag("M61_HUGE_PAGES", false);
+    options.mmap_threshold = env_size("M61_MMAP_THRESHOLD", 128 << 10);
+    options.sample_interval = env_size("M61_SAMPLE_INTERVAL", 0);
+#ifndef NDEBUG
+    options.quarantine = env_size("M61_QUARANTINE", 0);
+#endif
+    if (const char* trace = getenv("M61_TRACE"); trace && *trace) {
+        options.trace_fd = open(trace, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        options.trace = options.trace_fd >= 0;
+        options.trace_start = trace_now();
+    }
+    options.initialized.store(true, std::memory_order_release);
+}
+
+static void options_init() {
+    if (!options.initialized.load(std::memory_order_acquire)) {
+        std::lock_guard guard(heap_lock);
+        if (!options.initialized.load(std::memory_order_relaxed)) {
+            options_init_locked();
+        }
+    }
+}
+
+// bins[c]
+//    Doubly-linked list of free blocks whose size is at least
+//    `m61_class_size(c)` and less than `m61_class_size(c + 1)`. Bit `c` of
+//    `bin_map` is set iff `bins[c]` is nonempty, so the smallest bin that
+//    is guaranteed to fit a request is found in O(1).
+static m61_free_block* bins[m61_nclasses];
+static uint64_t bin_map[(m61_nclasses + 63) / 64];
+
+// buffers, spare_buffer
+//    All mapped buffers, and one empty buffer kept mapped (with its pages
+//    discarded) to avoid map/unmap thrash.
+static m61_memory_buffer* buffers;
+static m61_memory_buffer* spare_buffer;
+
+static uintptr_t heap_min;
+static uintptr_t heap_max;
+static size_t free_size;         // # bytes in binned free blocks
+
+// meta_alloc_locked(sz)
+//    Return `sz` bytes of zeroed, cache-line-aligned memory for allocator
+//    metadata. This memory comes straight from the OS and is never freed.
+//    Returns `nullptr` if the OS is out of memory. Caller must hold
+//    `heap_lock`.
+static void* meta_alloc_locked(size_t sz) {
+    static char* meta_pos;
+    static size_t meta_left;
+    sz = (sz + 63) & ~size_t(63);
+    if (sz > meta_left) {
+        size_t chunk = std::max(sz, size_t(64) << 10);
+        void* map = mmap(nullptr, chunk, PROT_READ | PROT_WRITE,
+                         MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (map == MAP_FAILED) {
+            return nullptr;
+        }
+        meta_pos = reinterpret_cast<char*>(map);
+        meta_left = chunk;
+    }
+    void* ptr = meta_pos;
+    meta_pos += sz;
+    meta_left -= sz;
+    return ptr;
+}
+
+
+// Page map
+//    A two-level radix tree from page number to what the allocator has
+//    mapped there, so any pointer can be classified in O(1) without
+//    touching the memory it points to. An entry is a kind in its low bits
+//    or'ed with a 16-aligned address: the buffer for `M61_PAGE_BUFFER`,
+//    the `m61_large_block` for `M61_PAGE_LARGE`, and for `M61_PAGE_FREED`
+//    the payload of a large block that has been unmapped (remembered to
+//    diagnose double frees). Leaves are mapped on demand and never freed.
+//    Entries change under `heap_lock`; lookups do not lock.
+static constexpr unsigned m61_page_shift = 12;
+static constexpr unsigned m61_pagemap_bits = 18;     // per level
+static constexpr size_t m61_pagemap_fanout = size_t(1) << m61_pagemap_bits;
+static constexpr uintptr_t M61_PAGE_BUFFER = 1;     // heap buffer
+static constexpr uintptr_t M61_PAGE_LARGE = 2;      // large block
+static constexpr uintptr_t M61_PAGE_FREED = 3;      // freed large block
+static constexpr uintptr_t M61_PAGE_POOL = 4;       // pool slab
+static constexpr uintptr_t M61_PAGE_ARENA = 5;      // arena memory
+static constexpr uintptr_t M61_PAGE_KIND = 15;
+
+static std::atomic<std::atomic<uintptr_t>*> pagemap[m61_pagemap_fanout];
+
+static inline uintptr_t pagemap_lookup(const void* ptr) {
+    uintptr_t pn = reinterpret_cast<uintptr_t>(ptr) >> m61_page_shift;
+    if (pn >= m61_pagemap_fanout * m61_pagemap_fanout) {
+        return 0;
+    }
+    std::atomic<uintptr_t>* leaf =
+        pagemap[pn >> m61_pagemap_bits].load(std::memory_order_acquire);
+    if (!leaf) {
+        return 0;
+    }
+    return leaf[pn & (m61_pagemap_fanout - 1)].load(std::memory_order_relaxed);
+}
+
+// pagemap_set_locked(first, last, entry)
+//    Set the entries for all pages overlapping [first, last) to `entry`.
+//    Returns false if out of memory. Caller must hold `heap_lock`.
+static bool pagemap_set_locked(const void* first, const void* last, uintptr_t entry) {
+    uintptr_t pn = reinterpret_cast<uintptr_t>(first) >> m61_page_shift;
+    uintptr_t pend = (reinterpret_cast<uintptr_t>(last) + (1 << m61_page_shift) - 1)
+        >> m61_page_shift;
+    for (; pn < pend; ++pn) {
+        auto& slot = pagemap[pn >> m61_pagemap_bits];
+        std::atomic<uintptr_t>* leaf = slot.load(std::memory_order_relaxed);
+        if (!leaf) {
+            void* map = mmap(nullptr, m61_pagemap_fanout * sizeof(uintptr_t),
+                             PROT_READ | PROT_WRITE,
+                             MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            leaf = reinterpret_cast<std::atomic<uintptr_t>*>(map);
+            slot.store(leaf, std::memory_order_release);
+        }
+        leaf[pn & (m61_pagemap_fanout - 1)].store(entry, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+
+static void bin_insert(m61_header* hdr) {
+    m61_free_block* fb = reinterpret_cast<m61_free_block*>(hdr);
+    unsigned c = m61_size_class_floor(block_size(hdr));
+    fb->next = bins[c];
+    fb->prev = nullptr;
+    if (fb->next) {
+        fb->next->prev = fb;
+    }
+    bins[c] = fb;
+    bin_map[c / 64] |= uint64_t(1) << (c % 64);
+    free_size += block_size(hdr);
+}
+
+static void bin_remove(m61_header* hdr) {
+    m61_free_block* fb = reinterpret_cast<m61_free_block*>(hdr);
+    unsigned c = m61_size_class_floor(block_size(hdr));
+    if (fb->prev) {
+        fb->prev->next = fb->next;
+    } else if (!(bins[c] = fb->next)) {
+        bin_map[c / 64] &= ~(uint64_t(1) << (c % 64));
+    }
+    if (fb->next) {
+        fb->next->prev = fb->prev;
+    }
+    free_size -= block_size(hdr);
+}
+
+// bin_find(sclass)
+//    Return a free block from the first nonempty bin at or above `sclass`,
+//    or `nullptr` if there is none.
+static m61_header* bin_find(unsigned sclass) {
+    for (unsigned w = sclass / 64; w * 64 < m61_nclasses; ++w) {
+        uint64_t bits = bin_map[w];
+        if (w == sclass / 64) {
+            bits &= ~uint64_t(0) << (sclass % 64);
+        }
+        if (bits) {
+            return &bins[w * 64 + __builtin_ctzl(bits)]->hdr;
+        }
+    }
+    return nullptr;
+}
+
+
+// buffer_map_locked()
+//    Map a new buffer. Its space becomes one free block, followed by an
+//    allocated zero-size fencepost header. Returns the free block (already
+//    binned), or `nullptr` if the OS is out of memory. Caller must hold
+//    `heap_lock`.
+static m61_header* buffer_map_locked() {
+    if (!options.initialized.load(std::memory_order_relaxed)) {
+        options_init_locked();
+    }
+    m61_memory_buffer* b = m61_memory_buffer::create(options.huge_pages);
+    if (!b) {
+        return nullptr;
+    } else if (!pagemap_set_locked(b, reinterpret_cast<char*>(b) + m61_buffer_size,
+                                   reinterpret_cast<uintptr_t>(b) | M61_PAGE_BUFFER)) {
+        b->destroy();
+        return nullptr;
+    }
+    b->next = buffers;
+    if (buffers) {
+        buffers->prev = b;
+    }
+    buffers = b;
+
+    m61_header* hdr = reinterpret_cast<m61_header*>(b->buffer);
+    hdr->tag = (b->size - sizeof(m61_header)) | M61_PREV_INUSE | M61_FIRST;
+    set_boundary_tag(hdr);
+    next_block(hdr)->tag = M61_INUSE;
+    bin_insert(hdr);
+    return hdr;
+}
+
+// buffer_release_locked(hdr)
+//    Called when free block `hdr` spans its whole buffer. One such buffer
+//    is kept as a spare, with its pages discarded via
+//    `madvise(MADV_DONTNEED)` so they no longer count toward RSS; others
+//    are unmapped. Caller must hold `heap_lock`.
+static void buffer_release_locked(m61_header* hdr) {
+    m61_memory_buffer* b = buffer_of(hdr);
+
+    if (!spare_buffer) {
+        spare_buffer = b;
+        // Discard the side table (the descriptor shares its first page).
+        // The state table is kept so double frees are still recognized.
+        madvise(reinterpret_cast<char*>(b) + 4096,
+                ((m61_buffer_descriptor_size + m61_side_table_size) & ~size_t(4095)) - 4096,
+                MADV_DONTNEED);
+        uintptr_t first = reinterpret_cast<uintptr_t>(hdr) + sizeof(m61_free_block);
+        first = (first + 4095) & ~uintptr_t(4095);
+        uintptr_t last = reinterpret_cast<uintptr_t>(next_block(hdr)) - sizeof(size_t);
+        last &= ~uintptr_t(4095);
+        if (first < last) {
+            madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+        }
+        return;
+    }
+
+    bin_remove(hdr);
+    if (b->prev) {
+        b->prev->next = b->next;
+    } else {
+        buffers = b->next;
+    }
+    if (b->next) {
+        b->next->prev = b->prev;
+    }
+    pagemap_set_locked(b, reinterpret_cast<char*>(b) + m61_buffer_size, 0);
+    b->destroy();
+}
+
+
+// central_take_locked(bsz)
+//    Remove and return a free block of at least `bsz` bytes from the bins,
+//    mapping a new buffer if necessary. Returns `nullptr` if out of memory.
+//    Caller must hold `heap_lock`.
+static m61_header* central_take_locked(size_t bsz) {
+    m61_header* hdr = bin_find(m61_size_class(bsz));
+    if (!hdr && !(hdr = buffer_map_locked())) {
+        return nullptr;
+    }
+    if (spare_buffer && hdr == reinterpret_cast<m61_header*>(spare_buffer->buffer)) {
+        spare_buffer = nullptr;
+    }
+    bin_remove(hdr);
+    return hdr;
+}
+
+// central_carve_locked(hdr, bsz)
+//    Turn `hdr`, a free block of at least `bsz` bytes that is in no bin,
+//    into an allocated block of `bsz` bytes. The tail is split off and
+//    binned if it is big enough to be a block. Caller must hold
+//    `heap_lock`.
+static m61_header* central_carve_locked(m61_header* hdr, size_t bsz) {
+    size_t have = block_size(hdr);
+    if (have - bsz >= m61_min_block) {
+        hdr->tag = bsz | (hdr->tag & M61_FLAGS);
+        m61_header* rest = next_block(hdr);
+        rest->tag = (have - bsz) | M61_PREV_INUSE;
+        set_boundary_tag(rest);
+        bin_insert(rest);
+    } else {
+        set_prev_inuse(next_block(hdr), true);
+    }
+    hdr->tag |= M61_INUSE;
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(hdr + 1);
+    if (!heap_min || heap_min > addr) {
+        heap_min = addr;
+    }
+    if (heap_max < reinterpret_cast<uintptr_t>(next_block(hdr))) {
+        heap_max = reinterpret_cast<uintptr_t>(next_block(hdr));
+    }
+    return hdr;
+}
+
+// central_alloc_locked(bsz)
+//    Return an allocated block of at least `bsz` bytes (a multiple of 16,
+//    at least `m61_min_block` and at most `m61_max_buffer_block`), or
+//    `nullptr` if out of memory. Caller must hold `heap_lock`.
+static m61_header* central_alloc_locked(size_t bsz) {
+    m61_header* hdr = central_take_locked(bsz);
+    return hdr ? central_carve_locked(hdr, bsz) : nullptr;
+}
+
+// central_alloc_aligned_locked(bsz, align)
+//    Like `central_alloc_locked`, but the payload is aligned to `align`, a
+//    power of two greater than 16. The block is cut from a free block with
+//    room for the worst-case misalignment; the bytes skipped to reach the
+//    alignment become a free block of their own, so nothing is wasted.
+//    Caller must hold `heap_lock`.
+static m61_header* central_alloc_aligned_locked(size_t bsz, size_t align) {
+    m61_header* hdr = central_take_locked(bsz + align + m61_min_block);
+    if (!hdr) {
+        return nullptr;
+    }
+    uintptr_t payload = reinterpret_cast<uintptr_t>(hdr + 1);
+    uintptr_t aligned = (payload + align - 1) & ~uintptr_t(align - 1);
+    if (aligned != payload && aligned - payload < m61_min_block) {
+        aligned += align;
+    }
+    if (size_t lead = aligned - payload) {
+        size_t have = block_size(hdr);
+        m61_header* lead_hdr = hdr;
+        hdr = reinterpret_cast<m61_header*>(reinterpret_cast<char*>(hdr) + lead);
+        hdr->tag = have - lead;
+        lead_hdr->tag = lead | (lead_hdr->tag & (M61_PREV_INUSE | M61_FIRST));
+        set_boundary_tag(lead_hdr);
+        bin_insert(lead_hdr);
+    }
+    return central_carve_locked(hdr, bsz);
+}
+
+// central_free_locked(hdr)
+//    Return allocated block `hdr` to the bins. Unless coalescing is off,
+//    the block first merges with free neighbors: the next block's header
+//    and the previous block's boundary tag make this O(1). A buffer that
+//    becomes entirely free is released. Caller must hold `heap_lock`.
+static void central_free_locked(m61_header* hdr) {
+    size_t bsz = block_size(hdr);
+    size_t flags = hdr->tag & (M61_PREV_INUSE | M61_FIRST);
+    m61_header* next = next_block(hdr);
+    if (options.coalesce) {
+        if (!(load_tag(next) & M61_INUSE)) {
+            bin_remove(next);
+            bsz += block_size(next);
+            next = reinterpret_cast<m61_header*>(reinterpret_cast<char*>(hdr) + bsz);
+        }
+        if (!(flags & M61_PREV_INUSE)) {
+            size_t psz = reinterpret_cast<size_t*>(hdr)[-1];
+            hdr = reinterpret_cast<m61_header*>(reinterpret_cast<char*>(hdr) - psz);
+            bin_remove(hdr);
+            bsz += psz;
+            flags = hdr->tag & (M61_PREV_INUSE | M61_FIRST);
+        }
+    }
+    hdr->tag = bsz | flags;
+    set_boundary_tag(hdr);
+    set_prev_inuse(next, false);
+    bin_insert(hdr);
+
+    if ((flags & M61_FIRST) && block_size(next) == 0) {
+        buffer_release_locked(hdr);
+    }
+}
+
+
+// central_resize_locked(hdr, bsz)
+//    Try to resize allocated block `hdr` to `bsz` bytes without moving it.
+//    A block grows by absorbing its successor, if that is free and big
+//    enough; a surplus tail is split off and freed. Returns false if the
+//    block cannot grow in place. Caller must hold `heap_lock`.
+static bool central_resize_locked(m61_header* hdr, size_t bsz) {
+    size_t have = block_size(hdr);
+    if (bsz > have) {
+        m61_header* next = next_block(hdr);
+        if ((load_tag(next) & M61_INUSE) || have + block_size(next) < bsz) {
+            return false;
+        }
+        bin_remove(next);
+        have += block_size(next);
+        hdr->tag = have | (hdr->tag & ~M61_SIZE_MASK);
+        set_prev_inuse(next_block(hdr), true);
+    }
+    if (have - bsz >= m61_min_block) {
+        hdr->tag = bsz | (hdr->tag & ~M61_SIZE_MASK);
+        m61_header* rest = next_block(hdr);
+        rest->tag = (have - bsz) | M61_PREV_INUSE | M61_INUSE;
+        central_free_locked(rest);
+    }
+    if (heap_max < reinterpret_cast<uintptr_t>(next_block(hdr))) {
+        heap_max = reinterpret_cast<uintptr_t>(next_block(hdr));
+    }
+    return true;
+}
+
+
+// m61_large_block
+//    A block with a mapping of its own. Large blocks are linked into a
+//    list so the leak report can find them. They are outside any buffer,
+//    so they keep their site inline.
+struct m61_large_block {
+    m61_large_block* prev;
+    m61_large_block* next;
+    m61_site* site;
+    m61_header hdr;
+};
+static_assert(sizeof(m61_large_block) % alignof(std::max_align_t) == 0,
+              "m61_large_block must preserve payload alignment");
+
+static m61_large_block* large_blocks;
+
+static inline m61_large_block* large_block_of(m61_header* hdr) {
+    return reinterpret_cast<m61_large_block*>(
+        reinterpret_cast<char*>(hdr) - offsetof(m61_large_block, hdr)
+    );
+}
+
+// block_capacity(hdr), block_request_size(hdr)
+//    Return the payload size of allocated block `hdr`, and the size that
+//    was requested for it.
+static inline size_t block_capacity(const m61_header* hdr) {
+    if (load_tag(hdr) & M61_MMAPPED) {
+        // Size is measured from the start of the mapping, the page holding
+        // the `m61_large_block`; an aligned payload may be pages past it
+        uintptr_t payload = reinterpret_cast<uintptr_t>(hdr + 1);
+        uintptr_t start = (payload - sizeof(m61_large_block)) & ~uintptr_t(4095);
+        return start + block_size(hdr) - payload;
+    }
+    return block_size(hdr) - sizeof(m61_header);
+}
+
+static inline size_t block_request_size(const m61_header* hdr) {
+    return block_capacity(hdr) - ((load_tag(hdr) >> M61_SLACK_SHIFT) & M61_MAX_SLACK);
+}
+
+// Canaries
+//    Every block has at least `m61_canary_size` bytes of room after the
+//    requested size, and the 8 bytes right after the request are set to
+//    `m61_canary` when the block is handed out. A write past the end of
+//    the request changes the canary; checking it is a single (possibly
+//    unaligned) 8-byte compare. The canary has no zero bytes, so a stray
+//    string terminator is caught. Pool and arena memory has no canaries,
+//    and neither does a block whose whole capacity was handed to the
+//    caller by `m61_usable_size` (its slack is 0).
+static constexpr size_t m61_canary_size = 8;
+static constexpr uint64_t m61_canary = 0xA5C3E1F00F1E3C5A;
+
+static inline void set_canary(void* ptr, size_t sz) {
+    memcpy(reinterpret_cast<char*>(ptr) + sz, &m61_canary, sizeof(m61_canary));
+}
+
+static inline bool canary_ok(const m61_header* hdr) {
+    if (block_request_size(hdr) == block_capacity(hdr)) {
+        return true;
+    }
+    uint64_t word;
+    memcpy(&word, reinterpret_cast<const char*>(hdr + 1) + block_request_size(hdr),
+           sizeof(word));
+    return word == m61_canary;
+}
+
+// check_canary(hdr, op, file, line)
+//    Unless canaries are checked lazily, report and abort if the canary of
+//    live block `hdr` has been overwritten. Called when the block is freed
+//    or reallocated at `file`:`line`.
+static inline void check_canary(m61_header* hdr, const char* op,
+                                const char* file, int line) {
+    if (!options.lazy_canaries && !canary_ok(hdr)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during %s of pointer %p\n",
+                file, line, op, static_cast<void*>(hdr + 1));
+        abort();
+    }
+}
+
+// large_alloc(sz, align)
+//    Allocate a block for a request of `sz` bytes, aligned to `align`, in a
+//    mapping of its own. Big requests would waste buffer space and are
+//    rare enough that a system call is cheap by comparison. The pages are
+//    fresh from the OS, so the block is already zeroed, and m61_free unmaps
+//    it right away. The block's size is that of the mapping, which starts
+//    on the page holding the `m61_large_block`. With huge pages on, blocks
+//    of 2 MiB or more are 2 MiB aligned so the OS can back them fully.
+static m61_header* large_alloc(size_t sz, size_t align) {
+    sz += m61_canary_size;
+    bool huge = options.huge_pages && sz >= m61_huge_page_size;
+    if (huge) {
+        align = std::max(align, m61_huge_page_size);
+    }
+    // Map enough for any placement, then trim whole pages at either end
+    size_t offset = std::max(align, sizeof(m61_large_block));
+    size_t len = (offset + sz + 4095) & ~size_t(4095);
+    if (align > 4096) {
+        len += align - 4096;
+    }
+    void* map = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t mapstart = reinterpret_cast<uintptr_t>(map);
+    uintptr_t payload = (mapstart + sizeof(m61_large_block) + align - 1)
+        & ~uintptr_t(align - 1);
+    uintptr_t start = (payload - sizeof(m61_large_block)) & ~uintptr_t(4095);
+    uintptr_t end = (payload + sz + 4095) & ~uintptr_t(4095);
+    if (start != mapstart) {
+        munmap(map, start - mapstart);
+    }
+    if (end != mapstart + len) {
+        munmap(reinterpret_cast<void*>(end), mapstart + len - end);
+    }
+    if (huge) {
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+    }
+    m61_large_block* lb = reinterpret_cast<m61_large_block*>(
+        payload - sizeof(m61_large_block)
+    );
+    lb->hdr.tag = (end - start) | M61_INUSE | M61_MMAPPED;
+
+    std::lock_guard guard(heap_lock);
+    if (!pagemap_set_locked(reinterpret_cast<void*>(start), reinterpret_cast<void*>(end),
+                            reinterpret_cast<uintptr_t>(lb) | M61_PAGE_LARGE)) {
+        munmap(reinterpret_cast<void*>(start), end - start);
+        return nullptr;
+    }
+    lb->prev = nullptr;
+    lb->next = large_blocks;
+    if (large_blocks) {
+        large_blocks->prev = lb;
+    }
+    large_blocks = lb;
+    uintptr_t addr = reinterpret_cast<uintptr_t>(&lb->hdr + 1);
+    if (!heap_min || heap_min > addr) {
+        heap_min = addr;
+    }
+    if (heap_max < addr + sz) {
+        heap_max = addr + sz;
+    }
+    return &lb->hdr;
+}
+
+// large_resize(hdr, sz)
+//    Resize large block `hdr` for a request of `sz` bytes with `mremap`,
+//    which may move the block but never copies its pages. Returns the
+//    block's new header, or `nullptr` if the OS is out of memory.
+static m61_header* large_resize(m61_header* hdr, size_t sz) {
+    sz += m61_canary_size;
+    m61_large_block* lb = large_block_of(hdr);
+    uintptr_t start = reinterpret_cast<uintptr_t>(lb) & ~uintptr_t(4095);
+    size_t offset = reinterpret_cast<uintptr_t>(hdr + 1) - start;
+    size_t len = (offset + sz + 4095) & ~size_t(4095);
+
+    size_t oldlen = block_size(hdr);
+
+    std::lock_guard guard(heap_lock);
+    void* map = mremap(reinterpret_cast<void*>(start), oldlen, len, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    pagemap_set_locked(reinterpret_cast<void*>(start),
+                       reinterpret_cast<char*>(start) + oldlen, 0);
+    lb = reinterpret_cast<m61_large_block*>(
+        reinterpret_cast<uintptr_t>(map) + offset - sizeof(m61_large_block)
+    );
+    // Can only fail if a new page map leaf cannot be mapped, by which
+    // point the block has already moved; then frees of it will be
+    // reported as invalid
+    (void) pagemap_set_locked(map, reinterpret_cast<char*>(map) + len,
+                              reinterpret_cast<uintptr_t>(lb) | M61_PAGE_LARGE);
+    lb->hdr.tag = len | (lb->hdr.tag & ~M61_SIZE_MASK);
+    if (lb->prev) {
+        lb->prev->next = lb;
+    } else {
+        large_blocks = lb;
+    }
+    if (lb->next) {
+        lb->next->prev = lb;
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(&lb->hdr + 1);
+    heap_min = std::min(heap_min, addr);
+    heap_max = std::max(heap_max, addr + sz);
+    return &lb->hdr;
+}
+
+static void large_free(m61_header* hdr) {
+    m61_large_block* lb = large_block_of(hdr);
+    {
+        std::lock_guard guard(heap_lock);
+        if (lb->prev) {
+            lb->prev->next = lb->next;
+        } else {
+            large_blocks = lb->next;
+        }
+        if (lb->next) {
+            lb->next->prev = lb->prev;
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(lb) & ~uintptr_t(4095);
+        pagemap_set_locked(reinterpret_cast<void*>(start),
+                           reinterpret_cast<char*>(start) + block_size(hdr),
+                           reinterpret_cast<uintptr_t>(hdr + 1) | M61_PAGE_FREED);
+    }
+    munmap(reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(lb) & ~uintptr_t(4095)),
+           block_size(hdr));
+}
+
+
+// m61_site
+//    A source location that allocates. Sites live in an open-addressing
+//    hash table keyed by (file, line) and are never freed, so a block can
+//    point at its site. Each site gets a dense `id`; its counters live in
+//    the statistics shards below, indexed by `id`, so the leak and
+//    heavy-hitter reports cost O(sites) rather than O(allocations). When
+//    sampling, only sampled blocks point at a site, and site counters hold
+//    estimates; see `sample_estimate`.
+struct m61_site {
+    const char* file;
+    int line;
+    unsigned id;
+    std::atomic<bool> traced;    // described in the trace
+};
+
+static constexpr unsigned m61_no_site = -1;
+
+// m61_site_counts
+//    One shard's counters for one site. When sampling, each sampled block
+//    adds its fractional weight, so the counters are doubles; they are
+//    rounded only when reported (see `site_totals`).
+struct m61_site_counts {
+    std::atomic<double> nactive;
+    std::atomic<double> active_size;
+    std::atomic<double> ntotal;
+    std::atomic<double> total_size;
+};
+
+// sample_estimate(sz)
+//    Return the estimated number of bytes allocated in requests of `sz`
+//    bytes for each such request that was sampled. Sampling takes the
+//    allocation that crosses each point of a Poisson process over the
+//    bytes allocated, so a request of `sz` bytes is sampled with probability
+//    1 - exp(-sz / interval); its weight is the inverse.
+static double sample_estimate(size_t sz) {
+    double p = -std::expm1(-double(sz) / options.sample_interval);
+    return sz / p;
+}
+
+// m61_stat_shard
+//    One thread's share of the allocation counters. Only the owning thread
+//    writes a shard, so an update is a few plain stores to a cache line no
+//    other thread writes. `m61_get_statistics` sums all shards. `seq` is a
+//    sequence lock: it is odd while an update is in progress, so readers
+//    can take a consistent snapshot of each shard without blocking it.
+//    Counters wrap (a thread may free blocks another thread allocated);
+//    only their sum is meaningful.
+struct alignas(64) m61_stat_shard {
+    std::atomic<unsigned> seq;
+    std::atomic<bool> in_use;
+    std::atomic<unsigned long long> nactive;
+    std::atomic<unsigned long long> active_size;
+    std::atomic<unsigned long long> ntotal;
+    std::atomic<unsigned long long> total_size;
+    std::atomic<unsigned long long> nfail;
+    std::atomic<unsigned long long> fail_size;
+    std::atomic<m61_site_counts*> sites;     // indexed by site id
+    std::atomic<size_t> nsites;              // # entries in `sites`
+    m61_stat_shard* next;        // in `stat_shards` list
+
+    inline void update(unsigned sid, long long dactive, long long dsize,
+                       size_t ntotal, size_t nfail, size_t nbytes);
+    void reserve_sites_locked(unsigned id);
+};
+
+// stat_shards
+//    List of all shards. Shards are recycled when their thread exits, and
+//    never freed.
+static std::atomic<m61_stat_shard*> stat_shards;
+
+// orphan_shard
+//    Shard for threads whose cache has already been torn down. Writers
+//    serialize on `heap_lock`.
+static constinit m61_stat_shard orphan_shard = {};
+
+// m61_stat_shard::update(sid, dactive, dsize, nalloc, nfailed, nbytes)
+//    Apply a change to the counters, and to those of site `sid` unless it
+//    is `m61_no_site`. The caller must have made room for `sid` in `sites`.
+inline void m61_stat_shard::update(unsigned sid, long long dactive, long long dsize,
+                                   size_t nalloc, size_t nfailed, size_t nbytes) {
+    auto relaxed = std::memory_order_relaxed;
+    unsigned s = this->seq.load(relaxed);
+    this->seq.store(s + 1, relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->nactive.store(this->nactive.load(relaxed) + dactive, relaxed);
+    this->active_size.store(this->active_size.load(relaxed) + dsize, relaxed);
+    if (nalloc) {
+        this->ntotal.store(this->ntotal.load(relaxed) + nalloc, relaxed);
+        this->total_size.store(this->total_size.load(relaxed) + nbytes, relaxed);
+    }
+    if (sid != m61_no_site) {
+        double count = dactive, bytes = dsize;
+        if (options.sample_interval) {
+            // Scale a sampled block up to the allocations it stands for
+            size_t sz = dsize < 0 ? -dsize : dsize;
+            double est = sample_estimate(sz);
+            count *= est / sz;
+            bytes = dsize < 0 ? -est : est;
+        }
+        m61_site_counts& sc = this->sites.load(relaxed)[sid];
+        sc.nactive.store(sc.nactive.load(relaxed) + count, relaxed);
+        sc.active_size.store(sc.active_size.load(relaxed) + bytes, relaxed);
+        if (nalloc) {
+            sc.ntotal.store(sc.ntotal.load(relaxed) + count, relaxed);
+            sc.total_size.store(sc.total_size.load(relaxed) + bytes, relaxed);
+        }
+    }
+    if (nfailed) {
+        this->nfail.store(this->nfail.load(relaxed) + nfailed, relaxed);
+        this->fail_size.store(this->fail_size.load(relaxed) + nbytes, relaxed);
+    }
+    this->seq.store(s + 2, std::memory_order_release);
+}
+
+// m61_stat_shard::reserve_sites_locked(id)
+//    Make room for the counters of site `id`. The array is replaced by a
+//    copy twice the size; readers may still be using the old one, so it
+//    is never freed. Only the shard's writer may call this, with
+//    `heap_lock` held.
+void m61_stat_shard::reserve_sites_locked(unsigned id) {
+    auto relaxed = std::memory_order_relaxed;
+    size_t n = this->nsites.load(relaxed);
+    if (id < n) {
+        return;
+    }
+    size_t newn = std::max({size_t(64), 2 * n, size_t(id) + 1});
+    void* mem = meta_alloc_locked(newn * sizeof(m61_site_counts));
+    if (!mem) {
+        return;
+    }
+    m61_site_counts* sc = reinterpret_cast<m61_site_counts*>(mem);
+    m61_site_counts* old = this->sites.load(relaxed);
+    for (size_t i = 0; i != n; ++i) {
+        sc[i].nactive.store(old[i].nactive.load(relaxed), relaxed);
+        sc[i].active_size.store(old[i].active_size.load(relaxed), relaxed);
+        sc[i].ntotal.store(old[i].ntotal.load(relaxed), relaxed);
+        sc[i].total_size.store(old[i].total_size.load(relaxed), relaxed);
+    }
+    this->sites.store(sc, std::memory_order_release);
+    this->nsites.store(newn, std::memory_order_release);
+}
+
+// m61_tcache
+//    Per-thread cache of free blocks for small size classes. Cached
+//    blocks are still allocated as far as the central heap is concerned,
+//    so they do not coalesce until they are drained. Most
+//    malloc/free pairs are served from the cache without touching shared
+//    state. An empty cache list is refilled from the central heap
+//    `m61_tcache_batch` blocks at a time, and a full one drains the same
+//    number back, so `heap_lock` is taken once per batch.
+static constexpr size_t m61_tcache_max_size = 1024;
+static constexpr unsigned m61_tcache_nclasses = m61_size_class(m61_tcache_max_size) + 1;
+static constexpr unsigned m61_tcache_batch = 16;
+static constexpr unsigned m61_tcache_limit = 2 * m61_tcache_batch;
+
+// Pools
+//    `m61_pool_alloc` serves the single-object allocations of node-based
+//    containers from slabs of same-size objects, in 8-byte size classes.
+//    Objects carry no header. Slabs are carved in order from one large
+//    reservation of address space, so an object's slab number is its
+//    offset in the reservation divided by `m61_pool_slab_size`, and slab
+//    descriptors and per-object metadata live in dense arrays elsewhere
+//    (keeping them in the slabs would make every slab's metadata compete
+//    for the same cache sets). Free objects are kept on per-thread lists,
+//    like the tcache; objects from exited threads (and overflow) live in
+//    `pool_free`. Slabs are never released.
+static constexpr size_t m61_pool_slab_size = 64 << 10;
+static constexpr size_t m61_pool_region_size = size_t(64) << 30;
+static constexpr size_t m61_pool_max_slabs = m61_pool_region_size / m61_pool_slab_size;
+static constexpr unsigned m61_pool_nclasses = m61_pool_max_size / 8;
+static constexpr unsigned m61_pool_batch = 64;
+static constexpr unsigned m61_pool_limit = 4 * m61_pool_batch;
+
+struct m61_pool_meta {
+    uint32_t site;               // site id, or `m61_no_site`
+    uint32_t size;               // requested size, or one of these:
+};
+static constexpr uint32_t m61_pool_free_object = -1;
+static constexpr uint32_t m61_pool_sentinel = -2;
+
+struct m61_pool_slab {
+    m61_pool_meta* meta;         // one per object
+    uint32_t object_size;
+    uint32_t magic;              // 2^32 / object_size, rounded up
+};
+
+struct m61_pool_object {
+    m61_pool_object* next;
+};
+
+static char* pool_region;        // reserved on first use
+static m61_pool_slab* pool_slabs;    // indexed by slab number
+static size_t pool_nslabs;
+static m61_pool_object* pool_free[m61_pool_nclasses];
+
+// Remote frees
+//    A cache-sized block freed by a thread other than the one that
+//    allocated it is pushed onto the allocating thread's remote-free
+//    queue, a lock-free multi-producer single-consumer stack, rather than
+//    into the freeing thread's cache. The owner takes the whole queue with
+//    one exchange when a cache list runs dry, before refilling from the
+//    central heap. So when one thread allocates and another frees, blocks
+//    flow back to the producer without `heap_lock`, and stay warm in its
+//    cache. Queue id 0 means no queue (all are claimed); blocks without
+//    an owner are freed locally. An exiting thread closes its queue;
+//    pushes to a closed queue go to the central heap. The owner also
+//    collects its queue when it drains a full cache list, but an owner that
+//    is idle or blocked collects nothing, so a queue holds at most
+//    `m61_remote_limit` blocks; frees past that go to the central heap too.
+static constexpr unsigned m61_nremote = 1 << (32 - m61_side_owner_shift);
+static constexpr unsigned m61_remote_limit = 8 * m61_tcache_limit;
+
+struct alignas(64) m61_remote_queue {
+    std::atomic<m61_free_block*> head;
+    std::atomic<unsigned> length;    // # blocks queued or being pushed
+    std::atomic<bool> claimed;
+};
+static m61_remote_queue remote_queues[m61_nremote];
+
+static inline m61_free_block* remote_closed() {
+    return reinterpret_cast<m61_free_block*>(uintptr_t(1));
+}
+
+// remote_claim()
+//    Claim a remote-free queue for this thread. Returns its id, or 0 if
+//    all are taken.
+static unsigned remote_claim() {
+    for (unsigned id = 1; id != m61_nremote; ++id) {
+        m61_remote_queue& q = remote_queues[id];
+        if (!q.claimed.load(std::memory_order_relaxed)
+            && !q.claimed.exchange(true, std::memory_order_acquire)) {
+            q.head.store(nullptr, std::memory_order_release);
+            return id;
+        }
+    }
+    return 0;
+}
+
+// remote_release_locked(id)
+//    Close remote-free queue `id` and return its blocks to the central
+//    heap. Called at thread exit. Caller must hold `heap_lock`.
+static void remote_release_locked(unsigned id) {
+    m61_remote_queue& q = remote_queues[id];
+    m61_free_block* fb = q.head.exchange(remote_closed(), std::memory_order_acquire);
+    unsigned n = 0;
+    while (fb) {
+        m61_free_block* next = fb->next;
+        central_free_locked(&fb->hdr);
+        fb = next;
+        ++n;
+    }
+    q.length.fetch_sub(n, std::memory_order_relaxed);
+    q.claimed.store(false, std::memory_order_release);
+}
+
+// remote_free(id, hdr)
+//    Push free block `hdr` onto remote-free queue `id`, or free it to the
+//    central heap if the queue is closed or full.
+static void remote_free(unsigned id, m61_header* hdr) {
+    m61_remote_queue& q = remote_queues[id];
+    m61_free_block* fb = reinterpret_cast<m61_free_block*>(hdr);
+    // Count the block before pushing it, so the owner never takes more
+    // blocks off the queue than `length` counts
+    bool full = q.length.fetch_add(1, std::memory_order_relaxed) >= m61_remote_limit;
+    m61_free_block* head = q.head.load(std::memory_order_relaxed);
+    do {
+        if (full || head == remote_closed()) {
+            q.length.fetch_sub(1, std::memory_order_relaxed);
+            std::lock_guard guard(heap_lock);
+            central_free_locked(hdr);
+            return;
+        }
+        fb->next = head;
+    } while (!q.head.compare_exchange_weak(head, fb, std::memory_order_release,
+                                           std::memory_order_relaxed));
+}
+
+
+struct m61_tcache {
+    m61_free_block* head[m61_tcache_nclasses];
+    unsigned count[m61_tcache_nclasses];
+    m61_pool_object* pool_head[m61_pool_nclasses];
+    unsigned pool_count[m61_pool_nclasses];
+    m61_stat_shard* shard;       // this thread's statistics
+    m61_site* last_site;         // most recently used allocation site
+    long long sample_left;       // bytes until next sampled allocation
+    uint64_t sample_rng;         // random state for sampling
+    char* trace_buf;             // buffered trace records
+    size_t trace_len;            // # bytes in `trace_buf`
+    uint16_t trace_thread;       // thread number in trace
+    uint8_t owner;               // remote-free queue id, or 0
+    bool initialized;            // reaper registered
+    bool disabled;               // thread is exiting; bypass the cache
+};
+
+// The cache itself is trivially destructible, so accessing it needs no
+// TLS guard. A separate reaper object returns cached blocks to the
+// central heap when the thread exits.
+static thread_local m61_tcache tcache;
+
+struct m61_tcache_reaper {
+    ~m61_tcache_reaper();
+};
+static thread_local m61_tcache_reaper tcache_reaper;
+static void trace_release();
+
+m61_tcache_reaper::~m61_tcache_reaper() {
+    trace_release();
+    std::lock_guard guard(heap_lock);
+    if (tcache.owner) {
+        remote_release_locked(tcache.owner);
+        tcache.owner = 0;
+    }
+    for (unsigned c = 0; c != m61_tcache_nclasses; ++c) {
+        while (m61_free_block* fb = tcache.head[c]) {
+            tcache.head[c] = fb->next;
+            central_free_locked(&fb->hdr);
+        }
+        tcache.count[c] = 0;
+    }
+    for (unsigned c = 0; c != m61_pool_nclasses; ++c) {
+        while (m61_pool_object* obj = tcache.pool_head[c]) {
+            tcache.pool_head[c] = obj->next;
+            obj->next = pool_free[c];
+            pool_free[c] = obj;
+        }
+        tcache.pool_count[c] = 0;
+    }
+    tcache.disabled = true;
+    if (tcache.shard) {
+        tcache.shard->in_use.store(false, std::memory_order_release);
+        tcache.shard = nullptr;
+    }
+}
+
+// tcache_init()
+//    Set up this thread's cache on first use: construct the reaper so it
+//    runs at exit, and claim a remote-free queue.
+static void __attribute__((noinline)) tcache_init() {
+    tcache.initialized = true;
+    (void) &tcache_reaper;
+    tcache.owner = remote_claim();
+}
+
+// remote_pending()
+//    Return true if this thread's remote-free queue may hold blocks.
+static inline bool remote_pending() {
+    return tcache.owner
+        && remote_queues[tcache.owner].head.load(std::memory_order_relaxed);
+}
+
+// remote_collect()
+//    Move the blocks on this thread's remote-free queue into its cache.
+//    Lists pushed past `m61_tcache_limit` are trimmed back to the central
+//    heap.
+static void remote_collect() {
+    m61_remote_queue& q = remote_queues[tcache.owner];
+    m61_free_block* fb = q.head.exchange(nullptr, std::memory_order_acquire);
+    m61_free_block* overflow = nullptr;
+    unsigned n = 0;
+    while (fb) {
+        ++n;
+        m61_free_block* next = fb->next;
+        unsigned c = m61_size_class_floor(block_size(&fb->hdr));
+        if (tcache.count[c] < m61_tcache_limit) {
+            fb->next = tcache.head[c];
+            tcache.head[c] = fb;
+            ++tcache.count[c];
+        } else {
+            fb->next = overflow;
+            overflow = fb;
+        }
+        fb = next;
+    }
+    q.length.fetch_sub(n, std::memory_order_relaxed);
+    if (overflow) {
+        std::lock_guard guard(heap_lock);
+        while (overflow) {
+            m61_free_block* next = overflow->next;
+            central_free_locked(&overflow->hdr);
+            overflow = next;
+        }
+    }
+}
+
+// tcache_refill(sclass)
+//    Move a batch of blocks of class `sclass` from the central heap into
+//    this thread's cache, after checking the remote-free queue. Returns
+//    one block for the caller, or `nullptr` if the heap is out of space.
+static m61_header* tcache_refill(unsigned sclass) {
+    if (!tcache.initialized) {
+        tcache_init();
+    }
+    if (remote_pending()) {
+        remote_collect();
+        if (m61_free_block* fb = tcache.head[sclass]) {
+            tcache.head[sclass] = fb->next;
+            --tcache.count[sclass];
+            return &fb->hdr;
+        }
+    }
+    std::lock_guard guard(heap_lock);
+    m61_header* hdr = central_alloc_locked(m61_class_size(sclass));
+    for (unsigned i = 1; hdr && i != m61_tcache_batch; ++i) {
+        m61_header* extra = central_alloc_locked(m61_class_size(sclass));
+        if (!extra) {
+            break;
+        }
+        m61_free_block* fb = reinterpret_cast<m61_free_block*>(extra);
+        fb->next = tcache.head[sclass];
+        tcache.head[sclass] = fb;
+        ++tcache.count[sclass];
+    }
+    return hdr;
+}
+
+// tcache_drain(sclass)
+//    Return a batch of cached blocks of class `sclass` to the central heap,
+//    then collect the remote-free queue, whose blocks may belong in other
+//    classes' lists.
+static void tcache_drain(unsigned sclass) {
+    {
+        std::lock_guard guard(heap_lock);
+        for (unsigned i = 0; i != m61_tcache_batch; ++i) {
+            m61_free_block* fb = tcache.head[sclass];
+            tcache.head[sclass] = fb->next;
+            central_free_locked(&fb->hdr);
+        }
+        tcache.count[sclass] -= m61_tcache_batch;
+    }
+    if (remote_pending()) {
+        remote_collect();
+    }
+}
+
+
+// site_table
+//    The table of sites. Lookups do not lock: slots are filled once and
+//    never cleared, and a full table is replaced by a copy twice the size
+//    (the old one is never freed). A lookup that misses in a stale table
+//    retries under `heap_lock`.
+struct m61_site_table {
+    size_t capacity;             // power of two
+    std::atomic<m61_site*>* slots;
+};
+
+static std::atomic<m61_site_table*> site_table;
+static size_t nsites;            // protected by `heap_lock`
+
+// site_list
+//    All sites, indexed by id, for side-table lookups. Grows like
+//    `site_table`.
+static std::atomic<m61_site**> site_list;
+static size_t site_list_capacity;    // protected by `heap_lock`
+
+static inline size_t site_hash(const char* file, int line) {
+    uint64_t h = reinterpret_cast<uintptr_t>(file) ^ (uint64_t(line) << 32);
+    h *= 0x9E3779B97F4A7C15;
+    return h ^ (h >> 29);
+}
+
+// site_probe(t, file, line)
+//    Return the slot in `t` holding site `file`:`line`, or the empty slot
+//    where it belongs.
+static std::atomic<m61_site*>* site_probe(m61_site_table* t,
+                                          const char* file, int line) {
+    size_t mask = t->capacity - 1;
+    for (size_t i = site_hash(file, line) & mask; ; i = (i + 1) & mask) {
+        m61_site* site = t->slots[i].load(std::memory_order_acquire);
+        if (!site || (site->file == file && site->line == line)) {
+            return &t->slots[i];
+        }
+    }
+}
+
+static m61_site_table* site_table_create_locked(size_t capacity) {
+    m61_site_table* t = reinterpret_cast<m61_site_table*>(
+        meta_alloc_locked(sizeof(m61_site_table))
+    );
+    void* slots = meta_alloc_locked(capacity * sizeof(std::atomic<m61_site*>));
+    if (!t || !slots) {
+        return nullptr;
+    }
+    t->capacity = capacity;
+    t->slots = reinterpret_cast<std::atomic<m61_site*>*>(slots);
+    return t;
+}
+
+// site_add(file, line)
+//    Slow path of `site_find`: look up `file`:`line` under the lock, adding
+//    it (and growing the table) if necessary. Returns `nullptr` if out of
+//    memory.
+static m61_site* __attribute__((noinline)) site_add(const char* file, int line) {
+    std::lock_guard guard(heap_lock);
+    m61_site_table* t = site_table.load(std::memory_order_relaxed);
+    if (t) {
+        if (m61_site* site = site_probe(t, file, line)->load(std::memory_order_relaxed)) {
+            return site;
+        }
+    }
+    if (nsites > m61_side_site_mask) {
+        return nullptr;          // ids must fit in a side table entry
+    }
+    if (!t || 2 * (nsites + 1) > t->capacity) {
+        m61_site_table* nt = site_table_create_locked(t ? 2 * t->capacity : 256);
+        if (!nt) {
+            return nullptr;
+        }
+        for (size_t i = 0; t && i != t->capacity; ++i) {
+            if (m61_site* site = t->slots[i].load(std::memory_order_relaxed)) {
+                site_probe(nt, site->file, site->line)->store(site, std::memory_order_relaxed);
+            }
+        }
+        site_table.store(nt, std::memory_order_release);
+        t = nt;
+    }
+    if (nsites == site_list_capacity) {
+        size_t newcap = std::max(size_t(256), 2 * site_list_capacity);
+        m61_site** nl = reinterpret_cast<m61_site**>(
+            meta_alloc_locked(newcap * sizeof(m61_site*))
+        );
+        if (!nl) {
+            return nullptr;
+        }
+        if (nsites) {
+            memcpy(nl, site_list.load(std::memory_order_relaxed),
+                   nsites * sizeof(m61_site*));
+        }
+        site_list.store(nl, std::memory_order_release);
+        site_list_capacity = newcap;
+    }
+    void* mem = meta_alloc_locked(sizeof(m61_site));
+    if (!mem) {
+        return nullptr;
+    }
+    m61_site* site = new (mem) m61_site;
+    site->file = file;
+    site->line = line;
+    site->id = nsites;
+    site->traced.store(false, std::memory_order_relaxed);
+    site_list.load(std::memory_order_relaxed)[nsites] = site;
+    site_probe(t, file, line)->store(site, std::memory_order_release);
+    ++nsites;
+    return site;
+}
+
+// site_find(file, line)
+//    Return the site record for `file`:`line`, creating it if necessary.
+static inline m61_site* site_find(const char* file, int line) {
+    m61_site* site = tcache.last_site;
+    if (site && site->file == file && site->line == line) {
+        return site;
+    }
+    m61_site_table* t = site_table.load(std::memory_order_acquire);
+    if (!t || !(site = site_probe(t, file, line)->load(std::memory_order_acquire))) {
+        site = site_add(file, line);
+    }
+    tcache.last_site = site;
+    return site;
+}
+
+// block_site_id(hdr), block_site(hdr)
+//    Return the site recorded for allocated block `hdr`, as an id (or
+//    `m61_no_site`) or as a pointer (or `nullptr`).
+static inline unsigned block_site_id(m61_header* hdr) {
+    if (!(load_tag(hdr) & M61_SITE)) {
+        return m61_no_site;
+    } else if (load_tag(hdr) & M61_MMAPPED) {
+        return large_block_of(hdr)->site->id;
+    } else {
+        return __atomic_load_n(side_entry(hdr), __ATOMIC_RELAXED) & m61_side_site_mask;
+    }
+}
+
+// block_owner(hdr)
+//    Return the remote-free queue id of the thread that allocated buffer
+//    block `hdr`, or 0.
+static inline unsigned block_owner(m61_header* hdr) {
+    return __atomic_load_n(side_entry(hdr), __ATOMIC_RELAXED) >> m61_side_owner_shift;
+}
+
+static inline m61_site* block_site(m61_header* hdr) {
+    unsigned sid = block_site_id(hdr);
+    if (sid == m61_no_site) {
+        return nullptr;
+    }
+    return site_list.load(std::memory_order_acquire)[sid];
+}
+
+// set_block_site(hdr, site)
+//    Record `site` (which may be `nullptr`) for allocated block `hdr`, and
+//    for buffer blocks, this thread as its owner. The caller sets
+//    `M61_SITE` to match.
+static inline void set_block_site(m61_header* hdr, m61_site* site) {
+    if (!(load_tag(hdr) & M61_MMAPPED)) {
+        // Atomic because heap scans read other threads' entries
+        __atomic_store_n(side_entry(hdr), (site ? site->id : 0)
+                         | (uint32_t(tcache.owner) << m61_side_owner_shift),
+                         __ATOMIC_RELAXED);
+    } else if (site) {
+        large_block_of(hdr)->site = site;
+    }
+}
+
+// sample_alloc(sz, file, line)
+//    Called when this thread's sampling countdown runs out during an
+//    allocation of `sz` bytes. Samples that allocation and draws the next
+//    countdown from an exponential distribution with mean
+//    `options.sample_interval`, so every allocated byte is equally likely
+//    to be sampled and allocation patterns cannot alias with the interval.
+//    Returns the allocation's site, or `nullptr` if it is not sampled.
+static m61_site* __attribute__((noinline)) sample_alloc(size_t sz,
+                                                        const char* file, int line) {
+    bool first = !tcache.sample_rng;
+    if (first) {
+        tcache.sample_rng = (reinterpret_cast<uintptr_t>(&tcache) ^ time(nullptr))
+            * 0x9E3779B97F4A7C15 | 1;
+    }
+    // xorshift64* generator
+    uint64_t x = tcache.sample_rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    tcache.sample_rng = x;
+    double u = ((x * 0x2545F4914F6CDD1D) >> 11) * 0x1.0p-53;
+    tcache.sample_left = std::llround(-std::log1p(-u) * options.sample_interval);
+    if (first || sz == 0) {
+        return nullptr;
+    }
+    return site_find(file, line);
+}
+
+// for_each_site(f)
+//    Call `f(site)` for every allocation site.
+template <typename F>
+static void for_each_site(F f) {
+    if (m61_site_table* t = site_table.load(std::memory_order_acquire)) {
+        for (size_t i = 0; i != t->capacity; ++i) {
+            if (m61_site* site = t->slots[i].load(std::memory_order_acquire)) {
+                f(site);
+            }
+        }
+    }
+}
+
+
+// orphan_update_locked(...)
+//    Update statistics in `orphan_shard`. The caller must hold `heap_lock`.
+static void orphan_update_locked(unsigned sid, long long dactive, long long dsize,
+                                 size_t nalloc, size_t nfailed, size_t nbytes) {
+    if (sid != m61_no_site) {
+        orphan_shard.reserve_sites_locked(sid);
+        if (sid >= orphan_shard.nsites.load(std::memory_order_relaxed)) {
+            sid = m61_no_site;
+        }
+    }
+    orphan_shard.update(sid, dactive, dsize, nalloc, nfailed, nbytes);
+}
+
+// stats_update_slow(...)
+//    Update statistics for a thread that has no shard yet (or has exited),
+//    or whose shard has no room for site `sid`. If no shard can be
+//    allocated, the update goes to `orphan_shard`.
+static void __attribute__((noinline)) stats_update_slow(
+        unsigned sid, long long dactive, long long dsize, size_t nalloc,
+        size_t nfailed, size_t nbytes) {
+    if (!tcache.disabled) {
+        if (!tcache.initialized) {
+            tcache_init();
+        }
+        // Adopt a shard from an exited thread, or make a new one
+        m61_stat_shard* sh = tcache.shard;
+        if (!sh) {
+            sh = stat_shards.load(std::memory_order_acquire);
+            for (; sh; sh = sh->next) {
+                bool expected = false;
+                if (sh->in_use.compare_exchange_strong(expected, true)) {
+                    break;
+                }
+            }
+        }
+        if (!sh || (sid != m61_no_site && sid >= sh->nsites.load(std::memory_order_relaxed))) {
+            std::lock_guard guard(heap_lock);
+            if (!sh) {
+                void* mem = meta_alloc_locked(sizeof(m61_stat_shard));
+                if (!mem) {
+                    orphan_update_locked(sid, dactive, dsize, nalloc, nfailed, nbytes);
+                    return;
+                }
+                sh = new (mem) m61_stat_shard;
+                sh->in_use.store(true, std::memory_order_relaxed);
+                sh->next = stat_shards.load(std::memory_order_relaxed);
+                stat_shards.store(sh, std::memory_order_release);
+            }
+            if (sid != m61_no_site) {
+                sh->reserve_sites_locked(sid);
+            }
+        }
+        tcache.shard = sh;
+        if (sid != m61_no_site && sid >= sh->nsites.load(std::memory_order_relaxed)) {
+            sid = m61_no_site;   // out of memory; drop the site counts
+        }
+        sh->update(sid, dactive, dsize, nalloc, nfailed, nbytes);
+    } else {
+        std::lock_guard guard(heap_lock);
+        orphan_update_locked(sid, dactive, dsize, nalloc, nfailed, nbytes);
+    }
+}
+
+static inline void stats_update(unsigned sid, long long dactive, long long dsize,
+                                size_t nalloc, size_t nfailed, size_t nbytes) {
+    m61_stat_shard* sh = tcache.shard;
+    if (sh && (sid < sh->nsites.load(std::memory_order_relaxed) || sid == m61_no_site)) {
+        sh->update(sid, dactive, dsize, nalloc, nfailed, nbytes);
+    } else {
+        stats_update_slow(sid, dactive, dsize, nalloc, nfailed, nbytes);
+    }
+}
+
+// site_totals(site)
+//    Return the counters for `site` summed over all shards, rounded.
+struct m61_site_totals {
+    unsigned long long nactive = 0;
+    unsigned long long active_size = 0;
+    unsigned long long ntotal = 0;
+    unsigned long long total_size = 0;
+};
+
+static m61_site_totals site_totals(m61_site* site) {
+    double v[4] = {};
+    auto sum_shard = [&] (m61_stat_shard* sh) {
+        size_t n = sh->nsites.load(std::memory_order_acquire);
+        if (site->id < n) {
+            m61_site_counts& sc = sh->sites.load(std::memory_order_acquire)[site->id];
+            v[0] += sc.nactive.load(std::memory_order_relaxed);
+            v[1] += sc.active_size.load(std::memory_order_relaxed);
+            v[2] += sc.ntotal.load(std::memory_order_relaxed);
+            v[3] += sc.total_size.load(std::memory_order_relaxed);
+        }
+    };
+    for (m61_stat_shard* sh = stat_shards.load(std::memory_order_acquire);
+         sh; sh = sh->next) {
+        sum_shard(sh);
+    }
+    sum_shard(&orphan_shard);
+    m61_site_totals t;
+    t.nactive = std::llround(v[0]);
+    t.active_size = std::llround(v[1]);
+    t.ntotal = std::llround(v[2]);
+    t.total_size = std::llround(v[3]);
+    return t;
+}
+
+// note_failure(sz)
+//    Account for a failed allocation of `sz` bytes.
+static void note_failure(size_t sz) {
+    stats_update(m61_no_site, 0, 0, 0, 1, sz);
+}
+
+
+// alloc_site(sz, file, line)
+//    Return the site to charge for an allocation of `sz` bytes at
+//    `file`:`line`, or `nullptr` if sampling skips this allocation.
+static inline m61_site* alloc_site(size_t sz, const char* file, int line) {
+    if (!options.sample_interval) {
+        return site_find(file, line);
+    } else if ((tcache.sample_left -= sz) < 0) {
+        return sample_alloc(sz, file, line);
+    } else {
+        return nullptr;
+    }
+}
+
+// finish_alloc(hdr, sz, file, line)
+//    Record that allocated block `hdr` holds a request for `sz` bytes made
+//    at `file`:`line`, and return its payload.
+static inline void* finish_alloc(m61_header* hdr, size_t sz,
+                                 const char* file, int line) {
+    size_t slack = block_capacity(hdr) - sz;
+    assert(slack <= M61_MAX_SLACK);
+    m61_site* site = alloc_site(sz, file, line);
+    set_block_site(hdr, site);
+    // Only the central heap changes `M61_PREV_INUSE` in a live block's
+    // tag, and this thread changes the rest, so update the rest with an
+    // atomic XOR (skipped when nothing changes)
+    size_t tag = load_tag(hdr);
+    size_t newtag = (tag & (M61_SIZE_MASK | M61_FLAGS)) | (slack << M61_SLACK_SHIFT)
+        | (site ? M61_SITE : 0);
+    if (size_t delta = (tag ^ newtag) & ~M61_PREV_INUSE) {
+        __atomic_fetch_xor(&hdr->tag, delta, __ATOMIC_RELAXED);
+    }
+    set_canary(hdr + 1, sz);
+    if (!(load_tag(hdr) & M61_MMAPPED)) {
+        // Release so a heap scan that sees the block live sees its canary
+        __atomic_store_n(state_entry(hdr + 1), M61_STATE_LIVE, __ATOMIC_RELEASE);
+    }
+
+    stats_update(site ? site->id : m61_no_site, 1, sz, 1, 0, sz);
+    return hdr + 1;
+}
+
+// bad_free(op, ptr, file, line, why, inside)
+//    Report an invalid `op` (free or realloc) of `ptr` at `file`:`line`
+//    and abort. If `ptr` lies within live block `inside`, also say where
+//    that block was allocated.
+[[noreturn]] static void __attribute__((noinline)) bad_free(
+        const char* op, void* ptr, const char* file, int line,
+        const char* why, m61_header* inside = nullptr) {
+    fprintf(stderr, "MEMORY BUG: %s:%d: invalid %s of pointer %p, %s\n",
+            file, line, op, ptr, why);
+    if (inside) {
+        size_t off = reinterpret_cast<char*>(ptr) - reinterpret_cast<char*>(inside + 1);
+        if (m61_site* site = block_site(inside)) {
+            fprintf(stderr, "  %s:%d: %p is %zu bytes inside a %zu byte region allocated here\n",
+                    site->file ? site->file : "?", site->line, ptr, off,
+                    block_request_size(inside));
+        } else {
+            fprintf(stderr, "  %p is %zu bytes inside a %zu byte region\n",
+                    ptr, off, block_request_size(inside));
+        }
+    }
+    abort();
+}
+
+// diagnose_free(op, ptr, file, line, entry)
+//    Called when `ptr`, with page map entry `entry`, is not the payload of
+//    a live block. Work out why and report it. Only bugs get here, so
+//    this may take time proportional to the size of a buffer.
+[[noreturn]] static void __attribute__((noinline)) diagnose_free(
+        const char* op, void* ptr, const char* file, int line, uintptr_t entry) {
+    char* cptr = reinterpret_cast<char*>(ptr);
+    bool aligned = reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) == 0;
+    switch (entry & M61_PAGE_KIND) {
+    case M61_PAGE_BUFFER: {
+        m61_memory_buffer* b = buffer_of(ptr);
+        if (cptr < b->buffer) {
+            bad_free(op, ptr, file, line, "not in heap");
+        }
+        // Find the closest live payload at or before `ptr`; only that
+        // block can contain it
+        uint8_t* first = state_entry(b->buffer);
+        uint8_t* st = state_entry(ptr);
+        while (st >= first && load_state(st) != M61_STATE_LIVE) {
+            --st;
+        }
+        if (st >= first) {
+            char* payload = reinterpret_cast<char*>(b)
+                + (st - state_entry(b)) * m61_state_granule;
+            m61_header* hdr = reinterpret_cast<m61_header*>(payload) - 1;
+            if (cptr < payload + std::max(block_request_size(hdr), size_t(1))) {
+                bad_free(op, ptr, file, line, "not allocated", hdr);
+            }
+        }
+        if (aligned && load_state(state_entry(ptr)) == M61_STATE_FREED) {
+            bad_free(op, ptr, file, line, "double free");
+        }
+        bad_free(op, ptr, file, line, "not allocated");
+    }
+    case M61_PAGE_LARGE: {
+        m61_large_block* lb = reinterpret_cast<m61_large_block*>(entry & ~M61_PAGE_KIND);
+        char* payload = reinterpret_cast<char*>(&lb->hdr + 1);
+        if (cptr > payload && cptr < payload + block_request_size(&lb->hdr)) {
+            bad_free(op, ptr, file, line, "not allocated", &lb->hdr);
+        }
+        bad_free(op, ptr, file, line, "not allocated");
+    }
+    case M61_PAGE_FREED:
+        if (reinterpret_cast<uintptr_t>(ptr) == (entry & ~M61_PAGE_KIND)) {
+            bad_free(op, ptr, file, line, "double free");
+        }
+        bad_free(op, ptr, file, line, "not in heap");
+    case M61_PAGE_POOL:
+    case M61_PAGE_ARENA:
+        bad_free(op, ptr, file, line, "not allocated");
+    default:
+        bad_free(op, ptr, file, line, "not in heap");
+    }
+}
+
+// check_free(op, ptr, file, line)
+//    Return the header of the live block whose payload is `ptr`, or
+//    report an invalid `op` and abort. Takes O(1) time.
+static inline m61_header* check_free(const char* op, void* ptr,
+                                     const char* file, int line) {
+    uintptr_t entry = pagemap_lookup(ptr);
+    m61_header* hdr = reinterpret_cast<m61_header*>(ptr) - 1;
+    if ((entry & M61_PAGE_KIND) == M61_PAGE_BUFFER) {
+        if (reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t) == 0
+            && load_state(state_entry(ptr)) == M61_STATE_LIVE) {
+            return hdr;
+        }
+    } else if ((entry & M61_PAGE_KIND) == M61_PAGE_LARGE) {
+        if (&reinterpret_cast<m61_large_block*>(entry & ~M61_PAGE_KIND)->hdr == hdr) {
+            return hdr;
+        }
+    }
+    diagnose_free(op, ptr, file, line, entry);
+}
+
+static inline size_t request_block_size(size_t sz) {
+    return std::max((sz + sizeof(m61_header) + m61_canary_size + 15) & ~size_t(15),
+                    m61_min_block);
+}
+
+
+// Quarantine
+//    With `options.quarantine` set, freed blocks are poisoned and held in
+//    a FIFO ring instead of being reused right away. A block leaves the
+//    ring when the ring is full or holds more than `options.quarantine`
+//    bytes; its poison is checked then, so a write through a dangling
+//    pointer is caught. Large blocks are not quarantined (they are
+//    unmapped, so dangling accesses fault anyway). Protected by
+//    `heap_lock`.
+static constexpr size_t m61_quarantine_slots = 1 << 14;
+static constexpr uint64_t m61_poison = 0xDBDBDBDBDBDBDBDB;
+
+static struct {
+    m61_header** ring;           // `m61_quarantine_slots` entries
+    size_t head;                 // index of oldest block
+    size_t count;                // # blocks in ring
+    size_t bytes;                // # bytes in ring
+} quarantine;
+
+// poison_check(hdr)
+//    Return the offset of the first byte of freed block `hdr`'s payload
+//    that no longer holds poison, or `SIZE_MAX` if it is intact. Compares
+//    a word at a time.
+static size_t poison_check(const m61_header* hdr) {
+    const uint64_t* w = reinterpret_cast<const uint64_t*>(hdr + 1);
+    size_t n = block_capacity(hdr) / sizeof(uint64_t);
+    for (size_t i = 0; i < n; i += 8) {
+        uint64_t diff = 0;
+        for (size_t j = i; j != std::min(i + 8, n); ++j) {
+            diff |= w[j] ^ m61_poison;
+        }
+        if (diff) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(w + i);
+            size_t k = 0;
+            while (p[k] == (m61_poison & 0xFF)) {
+                ++k;
+            }
+            return i * sizeof(uint64_t) + k;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// check_poison(hdr)
+//    Report and abort if freed block `hdr` was written after it was freed.
+static void check_poison(const m61_header* hdr) {
+    size_t off = poison_check(hdr);
+    if (off != SIZE_MAX) {
+        fprintf(stderr, "MEMORY BUG: detected write to freed object %p with size %zu, %zu bytes inside\n",
+                static_cast<const void*>(hdr + 1), block_request_size(hdr), off);
+        abort();
+    }
+}
+
+// quarantine_locked(hdr)
+//    Poison freed block `hdr` and add it to the quarantine. Returns the
+//    oldest blocks that must leave the ring to make room, as a list linked
+//    through `m61_free_block::next`; the caller must release them. Caller
+//    must hold `heap_lock`.
+static m61_free_block* quarantine_locked(m61_header* hdr) {
+    if (!quarantine.ring) {
+        quarantine.ring = reinterpret_cast<m61_header**>(
+            meta_alloc_locked(m61_quarantine_slots * sizeof(m61_header*))
+        );
+        if (!quarantine.ring) {
+            m61_free_block* fb = reinterpret_cast<m61_free_block*>(hdr);
+            fb->next = nullptr;
+            return fb;
+        }
+    }
+    memset(hdr + 1, m61_poison & 0xFF, block_capacity(hdr));
+    quarantine.ring[(quarantine.head + quarantine.count) % m61_quarantine_slots] = hdr;
+    ++quarantine.count;
+    quarantine.bytes += block_size(hdr);
+
+    m61_free_block* evicted = nullptr;
+    while (quarantine.count == m61_quarantine_slots
+           || quarantine.bytes > options.quarantine) {
+        m61_header* old = quarantine.ring[quarantine.head];
+        quarantine.head = (quarantine.head + 1) % m61_quarantine_slots;
+        --quarantine.count;
+        quarantine.bytes -= block_size(old);
+        check_poison(old);
+        m61_free_block* fb = reinterpret_cast<m61_free_block*>(old);
+        fb->next = evicted;
+        evicted = fb;
+    }
+    return evicted;
+}
+
+
+// Tracing
+//    With `M61_TRACE=FILE`, each public allocation call appends an
+//    `m61_trace_record` to FILE (see m61.hh). Records are collected in a
+//    per-thread buffer, which is written out under `trace_lock` when full
+//    and when the thread exits. Each site is described by a record the
+//    first time any thread traces it.
+static constexpr size_t m61_trace_buffer_size = 64 << 10;
+static constexpr size_t m61_trace_max_file = 1024;
+static std::mutex trace_lock;
+static std::atomic<unsigned> trace_nthreads;
+
+// trace_write(data, n)
+//    Write `n` bytes to the trace file.
+static void trace_write(const void* data, size_t n) {
+    std::lock_guard guard(trace_lock);
+    const char* p = reinterpret_cast<const char*>(data);
+    while (n != 0) {
+        ssize_t w = write(options.trace_fd, p, n);
+        if (w > 0) {
+            p += w;
+            n -= w;
+        } else if (w == 0 || errno != EINTR) {
+            return;
+        }
+    }
+}
+
+// trace_emit(data, n)
+//    Append `n` bytes to this thread's trace buffer, writing the buffer
+//    out first if it is full. Exiting threads write directly.
+static void trace_emit(const void* data, size_t n) {
+    if (!tcache.trace_buf && !tcache.disabled) {
+        void* buf = mmap(nullptr, m61_trace_buffer_size, PROT_READ | PROT_WRITE,
+                         MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (buf != MAP_FAILED) {
+            tcache.trace_buf = reinterpret_cast<char*>(buf);
+            (void) &tcache_reaper;   // construct reaper so it flushes at exit
+        }
+    }
+    if (!tcache.trace_buf) {
+        trace_write(data, n);
+        return;
+    }
+    if (tcache.trace_len + n > m61_trace_buffer_size) {
+        trace_write(tcache.trace_buf, tcache.trace_len);
+        tcache.trace_len = 0;
+    }
+    memcpy(tcache.trace_buf + tcache.trace_len, data, n);
+    tcache.trace_len += n;
+}
+
+// trace_release()
+//    Write out and unmap this thread's trace buffer. Called at thread
+//    exit.
+static void trace_release() {
+    if (tcache.trace_buf) {
+        trace_write(tcache.trace_buf, tcache.trace_len);
+        munmap(tcache.trace_buf, m61_trace_buffer_size);
+        tcache.trace_buf = nullptr;
+        tcache.trace_len = 0;
+    }
+}
+
+// trace_event(op, size, ptr, arg, file, line, [start])
+//    Record one call made at `file`:`line` in the trace. The record's
+//    `end_time` is now; its `time` is `start` (a `trace_now()` value taken
+//    before the call) if given, and otherwise now.
+static void __attribute__((noinline)) trace_event(uint8_t op, size_t size,
+        const void* ptr, uint64_t arg, const char* file, int line,
+        uint64_t start = 0) {
+    m61_trace_record r = {};
+    r.op = op;
+    r.end_time = trace_now() - options.trace_start;
+    r.time = start ? start - options.trace_start : r.end_time;
+    r.size = size;
+    r.ptr = reinterpret_cast<uintptr_t>(ptr);
+    r.arg = arg;
+    if (!tcache.trace_thread) {
+        tcache.trace_thread = ++trace_nthreads;
+    }
+    r.thread = tcache.trace_thread;
+    m61_site* site = site_find(file, line);
+    r.site = site ? site->id : m61_no_site;
+    if (site && !site->traced.exchange(true)) {
+        struct {
+            m61_trace_record r;
+            char file[m61_trace_max_file];
+        } desc = {};
+        size_t len = std::min(strlen(file), m61_trace_max_file);
+        desc.r.op = M61_TRACE_SITE;
+        desc.r.thread = r.thread;
+        desc.r.site = r.site;
+        desc.r.time = desc.r.end_time = r.time;
+        desc.r.size = line;
+        desc.r.arg = len;
+        memcpy(desc.file, file, len);
+        trace_emit(&desc, sizeof(desc.r) + ((len + 7) & ~size_t(7)));
+    }
+    trace_emit(&r, sizeof(r));
 }
 
-m61_memory_buffer::~m61_memory_buffer() {
-    munmap(this->buffer, this->size);
+
+// malloc_untraced(sz, file, line), free_untraced(ptr, file, line)
+//    The work of `m61_malloc` and `m61_free`. Other entry points call these
+//    so that each public call appears in the trace once.
+
+static inline void* malloc_untraced(size_t sz, const char* file, int line) {
+    if (sz > m61_max_size) {
+        note_failure(sz);
+        return nullptr;
+    }
+
+    size_t bsz = request_block_size(sz);
+    unsigned sclass = m61_size_class(bsz);
+    m61_header* hdr;
+    if (sclass < m61_tcache_nclasses && !tcache.disabled) {
+        if (m61_free_block* fb = tcache.head[sclass]) {
+            tcache.head[sclass] = fb->next;
+            --tcache.count[sclass];
+            hdr = &fb->hdr;
+        } else {
+            hdr = tcache_refill(sclass);
+        }
+    } else {
+        options_init();
+        if (sz >= options.mmap_threshold || bsz > m61_max_buffer_block) {
+            hdr = large_alloc(sz, alignof(std::max_align_t));
+        } else {
+            std::lock_guard guard(heap_lock);
+            hdr = central_alloc_locked(bsz);
+        }
+    }
+    if (!hdr) {
+        note_failure(sz);
+        return nullptr;
+    }
+    return finish_alloc(hdr, sz, file, line);
 }
 
 
+static inline void free_untraced(void* ptr, const char* file, int line) {
+    if (!ptr) {
+        return;
+    }
+    m61_header* hdr = check_free("free", ptr, file, line);
+    check_canary(hdr, "free", file, line);
+    stats_update(block_site_id(hdr), -1, -(long long) block_request_size(hdr), 0, 0, 0);
+
+    if (load_tag(hdr) & M61_MMAPPED) {
+        large_free(hdr);
+        return;
+    }
+    store_state(state_entry(ptr), M61_STATE_FREED);
+    if (options.quarantine) {
+        // Blocks leaving quarantine go back to the central heap
+        std::lock_guard guard(heap_lock);
+        m61_free_block* fb = quarantine_locked(hdr);
+        while (fb) {
+            m61_free_block* next = fb->next;
+            central_free_locked(&fb->hdr);
+            fb = next;
+        }
+        return;
+    }
+    unsigned sclass = m61_size_class_floor(block_size(hdr));
+    if (sclass < m61_tcache_nclasses && !tcache.disabled) {
+        unsigned owner = block_owner(hdr);
+        if (owner && owner != tcache.owner) {
+            remote_free(owner, hdr);
+            return;
+        }
+        m61_free_block* fb = reinterpret_cast<m61_free_block*>(hdr);
+        fb->next = tcache.head[sclass];
+        tcache.head[sclass] = fb;
+        if (++tcache.count[sclass] > m61_tcache_limit) {
+            tcache_drain(sclass);
+        }
+    } else {
+        std::lock_guard guard(heap_lock);
+        central_free_locked(hdr);
+    }
+}
 
 
 /// m61_malloc(sz, file, line)
@@ -44,16 +2103,10 @@ m61_memory_buffer::~m61_memory_buffer() {
 ///    The allocation request was made at source code location `file`:`line`.
 
 void* m61_malloc(size_t sz, const char* file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    // Your code here.
-    if (default_buffer.pos + sz > default_buffer.size) {
-        // Not enough space left in default buffer for allocation
-        return nullptr;
+    void* ptr = malloc_untraced(sz, file, line);
+    if (options.trace) {
+        trace_event(M61_TRACE_MALLOC, sz, ptr, 0, file, line);
     }
-
-    // Otherwise there is enough space; claim the next `sz` bytes
-    void* ptr = &default_buffer.buffer[default_buffer.pos];
-    default_buffer.pos += sz;
     return ptr;
 }
 
@@ -62,12 +2115,16 @@ void* m61_malloc(size_t sz, const char* file, int line) {
 ///    Frees the memory allocation pointed to by `ptr`. If `ptr == nullptr`,
 ///    does nothing. Otherwise, `ptr` must point to a currently active
 ///    allocation returned by `m61_malloc`. The free was called at location
-///    `file`:`line`.
+///    `file`:`line`. Invalid and double frees are reported and abort the
+///    program; checking a pointer takes O(1) time (see the page map).
 
 void m61_free(void* ptr, const char* file, int line) {
-    // avoid uninitialized variable warnings
-    (void) ptr, (void) file, (void) line;
-    // Your code here. The handout code does nothing!
+    if (ptr && options.trace) {
+        // Traced before the block can be reused, so that in time order a
+        // pointer id is freed before it is allocated again
+        trace_event(M61_TRACE_FREE, 0, ptr, 0, file, line);
+    }
+    free_untraced(ptr, file, line);
 }
 
 
@@ -79,36 +2136,787 @@ void m61_free(void* ptr, const char* file, int line) {
 ///    also return `nullptr` if `count == 0` or `size == 0`.
 
 void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
-    // Your code here (to fix test019).
-    void* ptr = m61_malloc(count * sz, file, line);
-    if (ptr) {
-        memset(ptr, 0, count * sz);
+    size_t total;
+    void* ptr = nullptr;
+    if (__builtin_mul_overflow(count, sz, &total)) {
+        note_failure(SIZE_MAX);
+    } else {
+        ptr = malloc_untraced(total, file, line);
+        // Blocks with their own mapping are fresh from the OS, so already zero
+        if (ptr && !(reinterpret_cast<m61_header*>(ptr)[-1].tag & M61_MMAPPED)) {
+            memset(ptr, 0, total);
+        }
+    }
+    if (options.trace) {
+        trace_event(M61_TRACE_CALLOC, sz, ptr, count, file, line);
+    }
+    return ptr;
+}
+
+
+// realloc_untraced(ptr, sz, file, line)
+// aligned_alloc_untraced(align, sz, file, line)
+//    The work of `m61_realloc` and `m61_aligned_alloc`.
+
+static void* realloc_untraced(void* ptr, size_t sz, const char* file, int line) {
+    if (!ptr) {
+        return malloc_untraced(sz, file, line);
+    } else if (sz == 0) {
+        free_untraced(ptr, file, line);
+        return nullptr;
+    }
+    m61_header* hdr = check_free("realloc", ptr, file, line);
+    check_canary(hdr, "realloc", file, line);
+    if (sz > m61_max_size) {
+        note_failure(sz);
+        return nullptr;
+    }
+
+    size_t oldsz = block_request_size(hdr);
+    m61_header* newhdr = nullptr;
+    if (load_tag(hdr) & M61_MMAPPED) {
+        if (sz >= options.mmap_threshold) {
+            newhdr = large_resize(hdr, sz);
+        }
+    } else {
+        size_t bsz = request_block_size(sz);
+        if (sz < options.mmap_threshold && bsz <= m61_max_buffer_block) {
+            std::lock_guard guard(heap_lock);
+            if (central_resize_locked(hdr, bsz)) {
+                newhdr = hdr;
+            }
+        }
+    }
+
+    if (!newhdr) {
+        void* newptr = malloc_untraced(sz, file, line);
+        if (newptr) {
+            memcpy(newptr, ptr, std::min(oldsz, sz));
+            free_untraced(ptr, file, line);
+        }
+        return newptr;
+    }
+    stats_update(block_site_id(newhdr), -1, -(long long) oldsz, 0, 0, 0);
+    return finish_alloc(newhdr, sz, file, line);
+}
+
+
+static void* aligned_alloc_untraced(size_t align, size_t sz,
+                                    const char* file, int line) {
+    if (align == 0 || (align & (align - 1)) != 0
+        || sz > m61_max_size || align > m61_max_size) {
+        note_failure(sz);
+        return nullptr;
+    } else if (align <= alignof(std::max_align_t)) {
+        return malloc_untraced(sz, file, line);
+    }
+
+    options_init();
+    size_t bsz = request_block_size(sz);
+    m61_header* hdr;
+    if (sz >= options.mmap_threshold
+        || bsz + align + m61_min_block > m61_max_buffer_block) {
+        hdr = large_alloc(sz, align);
+    } else {
+        std::lock_guard guard(heap_lock);
+        hdr = central_alloc_aligned_locked(bsz, align);
+    }
+    if (!hdr) {
+        note_failure(sz);
+        return nullptr;
+    }
+    return finish_alloc(hdr, sz, file, line);
+}
+
+
+/// m61_realloc(ptr, sz, file, line)
+///    Changes the size of the dynamic allocation pointed to by `ptr` to
+///    `sz` bytes, preserving its contents up to the smaller of the old and
+///    new sizes, and returns a pointer to the resized allocation. The block
+///    is resized in place when possible: a heap block grows into a free
+///    successor, and a block with its own mapping is remapped. Otherwise
+///    the data is copied to a new allocation. If `ptr == nullptr`, behaves
+///    like `m61_malloc`; if `sz == 0`, frees `ptr` and returns `nullptr`.
+///    Returns `nullptr`, leaving `ptr` allocated, if out of memory.
+
+void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+    // One time cannot order both halves of a realloc. The record's `time`
+    // is taken before `ptr` can be freed and reused, as in `m61_free`, so
+    // another thread's allocation of the old address sorts later; its
+    // `end_time` is taken after `newptr` is ours, so another thread's
+    // earlier free of the new address sorts earlier.
+    uint64_t start = options.trace ? trace_now() : 0;
+    void* newptr = realloc_untraced(ptr, sz, file, line);
+    if (options.trace) {
+        trace_event(M61_TRACE_REALLOC, sz, newptr, reinterpret_cast<uintptr_t>(ptr),
+                    file, line, start);
+    }
+    return newptr;
+}
+
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory
+///    aligned to a multiple of `align`, which must be a power of two.
+///    Returns `nullptr` if `align` is invalid or out of memory. The memory
+///    skipped to reach the alignment stays available for other blocks.
+
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, int line) {
+    void* ptr = aligned_alloc_untraced(align, sz, file, line);
+    if (options.trace) {
+        trace_event(M61_TRACE_ALIGNED_ALLOC, sz, ptr, align, file, line);
     }
     return ptr;
 }
 
 
+/// m61_memalign(align, sz, file, line)
+///    Same as `m61_aligned_alloc`.
+
+void* m61_memalign(size_t align, size_t sz, const char* file, int line) {
+    return m61_aligned_alloc(align, sz, file, line);
+}
+
+
+/// m61_usable_size(ptr)
+///    Returns the number of bytes usable at `ptr`, which must be live
+///    `m61_malloc` memory: the whole capacity of its block. The caller may
+///    use all of it, so the block loses its canary. Returns 0 if
+///    `ptr == nullptr`.
+
+size_t m61_usable_size(void* ptr, const char* file, int line) {
+    if (!ptr) {
+        return 0;
+    }
+    m61_header* hdr = check_free("malloc_usable_size", ptr, file, line);
+    check_canary(hdr, "malloc_usable_size", file, line);
+    size_t oldsz = block_request_size(hdr), sz = block_capacity(hdr);
+    if (oldsz != sz) {
+        // Count the block at its new size, and clear its slack
+        unsigned sid = block_site_id(hdr);
+        stats_update(sid, -1, -(long long) oldsz, 0, 0, 0);
+        __atomic_fetch_and(&hdr->tag, ~(M61_MAX_SLACK << M61_SLACK_SHIFT), __ATOMIC_RELAXED);
+        stats_update(sid, 1, sz, 0, 0, 0);
+    }
+    return sz;
+}
+
+
+/// m61_fork_prepare(), m61_fork_parent(), m61_fork_child()
+///    `pthread_atfork` handlers. The prepare handler takes the allocator's
+///    locks, so no other thread holds them when the process forks; the
+///    others release them. In the child, the only thread is the one that
+///    forked, so other threads' in-progress statistics updates are
+///    abandoned, and trace records buffered before the fork are left for
+///    the parent to write.
+
+void m61_fork_prepare() {
+    trace_lock.lock();
+    heap_lock.lock();
+}
+
+void m61_fork_parent() {
+    heap_lock.unlock();
+    trace_lock.unlock();
+}
+
+void m61_fork_child() {
+    for (m61_stat_shard* sh = stat_shards.load(std::memory_order_relaxed);
+         sh; sh = sh->next) {
+        unsigned seq = sh->seq.load(std::memory_order_relaxed);
+        if (seq & 1) {
+            sh->seq.store(seq + 1, std::memory_order_relaxed);
+        }
+    }
+    tcache.trace_len = 0;
+    heap_lock.unlock();
+    trace_lock.unlock();
+}
+
+
+// pool_slab_create_locked(c)
+//    Carve a slab for pool class `c` and put its objects on `pool_free[c]`.
+//    Returns false if out of memory or address space. Caller must hold
+//    `heap_lock`.
+static bool pool_slab_create_locked(unsigned c) {
+    if (!pool_region) {
+        void* region = mmap(nullptr, m61_pool_region_size, PROT_NONE,
+                            MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        void* slabs = mmap(nullptr, m61_pool_max_slabs * sizeof(m61_pool_slab),
+                           PROT_READ | PROT_WRITE,
+                           MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED || slabs == MAP_FAILED) {
+            return false;
+        }
+        pool_region = reinterpret_cast<char*>(region);
+        pool_slabs = reinterpret_cast<m61_pool_slab*>(slabs);
+    }
+    if (pool_nslabs == m61_pool_max_slabs) {
+        return false;
+    }
+    char* base = pool_region + pool_nslabs * m61_pool_slab_size;
+    size_t object_size = (c + 1) * 8;
+    size_t n = m61_pool_slab_size / object_size;
+    void* meta = meta_alloc_locked((n + 1) * sizeof(m61_pool_meta));
+    if (!meta
+        || mprotect(base, m61_pool_slab_size, PROT_READ | PROT_WRITE) != 0
+        || !pagemap_set_locked(base, base + m61_pool_slab_size, M61_PAGE_POOL)) {
+        return false;
+    }
+
+    m61_pool_slab& slab = pool_slabs[pool_nslabs];
+    slab.meta = reinterpret_cast<m61_pool_meta*>(meta);
+    slab.object_size = object_size;
+    slab.magic = (uint64_t(1) << 32) / object_size + 1;
+    slab.meta[n].site = m61_no_site;
+    slab.meta[n].size = m61_pool_sentinel;
+    for (size_t i = n; i != 0; --i) {
+        slab.meta[i - 1].site = m61_no_site;
+        slab.meta[i - 1].size = m61_pool_free_object;
+        m61_pool_object* obj = reinterpret_cast<m61_pool_object*>(
+            base + (i - 1) * object_size
+        );
+        obj->next = pool_free[c];
+        pool_free[c] = obj;
+    }
+    ++pool_nslabs;
+
+    if (!heap_min || heap_min > reinterpret_cast<uintptr_t>(base)) {
+        heap_min = reinterpret_cast<uintptr_t>(base);
+    }
+    heap_max = std::max(heap_max, reinterpret_cast<uintptr_t>(base + m61_pool_slab_size));
+    return true;
+}
+
+// pool_refill(c)
+//    Return an object of pool class `c` from `pool_free`, moving a batch
+//    more into this thread's list. Returns `nullptr` if out of memory.
+static m61_pool_object* pool_refill(unsigned c) {
+    std::lock_guard guard(heap_lock);
+    if (!pool_free[c] && !pool_slab_create_locked(c)) {
+        return nullptr;
+    }
+    m61_pool_object* obj = pool_free[c];
+    pool_free[c] = obj->next;
+    for (unsigned i = 0; i != m61_pool_batch && pool_free[c] && !tcache.disabled; ++i) {
+        m61_pool_object* extra = pool_free[c];
+        pool_free[c] = extra->next;
+        extra->next = tcache.pool_head[c];
+        tcache.pool_head[c] = extra;
+        ++tcache.pool_count[c];
+    }
+    return obj;
+}
+
+// pool_drain(c)
+//    Move a batch of objects from this thread's list to `pool_free`.
+static void pool_drain(unsigned c) {
+    std::lock_guard guard(heap_lock);
+    for (unsigned i = 0; i != m61_pool_batch; ++i) {
+        m61_pool_object* obj = tcache.pool_head[c];
+        tcache.pool_head[c] = obj->next;
+        obj->next = pool_free[c];
+        pool_free[c] = obj;
+    }
+    tcache.pool_count[c] -= m61_pool_batch;
+}
+
+// pool_meta(ptr)
+//    Return the metadata of the pool object containing `ptr`, which must
+//    be in a slab. If `exact` is non-null, set it to whether `ptr` is the
+//    object's start. An address in the slack at the end of a slab maps to
+//    the sentinel entry after the slab's last object.
+static inline m61_pool_meta* pool_meta(void* ptr, bool* exact = nullptr) {
+    size_t off = reinterpret_cast<char*>(ptr) - pool_region;
+    m61_pool_slab& slab = pool_slabs[off / m61_pool_slab_size];
+    off %= m61_pool_slab_size;
+    size_t i = (off * slab.magic) >> 32;
+    if (exact) {
+        *exact = i * slab.object_size == off;
+    }
+    return &slab.meta[i];
+}
+
+
+/// m61_pool_alloc(sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory
+///    from a slab pool. `sz` must be at most `m61_pool_max_size`; the
+///    memory must be freed with `m61_pool_free`. Pool allocations count in
+///    the statistics and leak reports like any other.
+
+void* m61_pool_alloc(size_t sz, const char* file, int line) {
+    assert(sz <= m61_pool_max_size);
+    unsigned c = sz ? (sz - 1) / 8 : 0;
+    m61_pool_object* obj = tcache.pool_head[c];
+    if (obj) {
+        tcache.pool_head[c] = obj->next;
+        --tcache.pool_count[c];
+    } else if (!(obj = pool_refill(c))) {
+        // Out of pool address space: fall back to the general heap
+        return m61_malloc(sz, file, line);
+    }
+
+    m61_site* site = alloc_site(sz, file, line);
+    m61_pool_meta* meta = pool_meta(obj);
+    meta->site = site ? site->id : m61_no_site;
+    meta->size = sz;
+    stats_update(meta->site, 1, sz, 1, 0, sz);
+    return obj;
+}
+
+
+/// m61_pool_free(ptr, file, line)
+///    Frees a pool allocation returned by `m61_pool_alloc`. If
+///    `ptr == nullptr`, does nothing.
+
+void m61_pool_free(void* ptr, const char* file, int line) {
+    (void) file, (void) line;   // avoid uninitialized variable warnings
+    if (!ptr) {
+        return;
+    } else if ((pagemap_lookup(ptr) & M61_PAGE_KIND) != M61_PAGE_POOL) {
+        // Not from a slab: `m61_pool_alloc` fell back to the heap (or
+        // this is a bug, which `m61_free` will report)
+        m61_free(ptr, file, line);
+        return;
+    }
+    bool exact;
+    m61_pool_meta* meta = pool_meta(ptr, &exact);
+    if (!exact || meta->size == m61_pool_sentinel) {
+        bad_free("free", ptr, file, line, "not allocated");
+    } else if (meta->size == m61_pool_free_object) {
+        bad_free("free", ptr, file, line, "double free");
+    }
+    stats_update(meta->site, -1, -(long long) meta->size, 0, 0, 0);
+    unsigned c = meta->size ? (meta->size - 1) / 8 : 0;
+    meta->site = m61_no_site;
+    meta->size = m61_pool_free_object;
+
+    m61_pool_object* obj = reinterpret_cast<m61_pool_object*>(ptr);
+    if (!tcache.disabled) {
+        obj->next = tcache.pool_head[c];
+        tcache.pool_head[c] = obj;
+        if (++tcache.pool_count[c] > m61_pool_limit) {
+            pool_drain(c);
+        }
+    } else {
+        std::lock_guard guard(heap_lock);
+        obj->next = pool_free[c];
+        pool_free[c] = obj;
+    }
+}
+
+
+// m61_arena
+//    A region allocator. Allocations are bumped from a chain of memory
+//    buffers that the arena owns (they are not part of the heap), and are
+//    released all at once. The arena descriptor lives at the start of its
+//    first buffer. Requests of `options.mmap_threshold` bytes or more get
+//    mappings of their own, so they do not waste the rest of a buffer.
+//    Arena memory counts in the statistics as allocations charged to the
+//    arena's creation site. Live arenas are linked into a list (protected
+//    by `heap_lock`) so the leak report can find them.
+struct m61_arena_large {
+    m61_arena_large* next;
+    size_t mapsize;
+};
+static_assert(sizeof(m61_arena_large) % alignof(std::max_align_t) == 0,
+              "m61_arena_large must preserve payload alignment");
+
+struct m61_arena {
+    char* pos;                   // next free byte in `cur`
+    char* end;                   // end of `cur`
+    m61_memory_buffer* first;
+    m61_memory_buffer* cur;
+    m61_arena_large* large;
+    m61_site* site;
+    unsigned long long nactive;
+    unsigned long long active_size;
+    m61_arena* prev;
+    m61_arena* next;
+};
+
+static m61_arena* arenas;
+
+// arena_start(arena)
+//    Return the first allocatable byte of `arena`'s first buffer.
+static inline char* arena_start(m61_arena* arena) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(arena + 1);
+    return reinterpret_cast<char*>((p + 15) & ~uintptr_t(15));
+}
+
+// arena_map_locked(map, len, first, last)
+//    Enter arena mapping [map, map + len) in the page map, and widen the
+//    heap bounds to cover its allocatable memory [first, last). Returns
+//    false if out of memory. Caller must hold `heap_lock`.
+static bool arena_map_locked(void* map, size_t len, char* first, char* last) {
+    if (!pagemap_set_locked(map, reinterpret_cast<char*>(map) + len, M61_PAGE_ARENA)) {
+        return false;
+    }
+    if (!heap_min || heap_min > reinterpret_cast<uintptr_t>(first)) {
+        heap_min = reinterpret_cast<uintptr_t>(first);
+    }
+    heap_max = std::max(heap_max, reinterpret_cast<uintptr_t>(last));
+    return true;
+}
+
+// arena_unmap_locked(map, len)
+//    Remove arena mapping [map, map + len) from the page map and return it
+//    to the OS. Caller must hold `heap_lock`.
+static void arena_unmap_locked(void* map, size_t len) {
+    pagemap_set_locked(map, reinterpret_cast<char*>(map) + len, 0);
+    munmap(map, len);
+}
+
+// arena_alloc_slow(arena, sz, asz)
+//    Allocate `sz` bytes (`asz` rounded) when `arena`'s current buffer is
+//    full: in a mapping of its own if `sz` is large, otherwise from the
+//    next buffer in the chain, which is mapped if necessary. Returns
+//    `nullptr` if out of memory.
+static void* arena_alloc_slow(m61_arena* arena, size_t sz, size_t asz) {
+    options_init();
+    m61_memory_buffer* b = arena->cur->next;
+    if (sz >= options.mmap_threshold
+        || asz > arena->first->size - 16) {
+        size_t len = sizeof(m61_arena_large) + asz;
+        void* map = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                         MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (map == MAP_FAILED) {
+            return nullptr;
+        }
+        m61_arena_large* lg = new (map) m61_arena_large{arena->large, len};
+        std::lock_guard guard(heap_lock);
+        if (!arena_map_locked(map, len, reinterpret_cast<char*>(lg + 1),
+                              reinterpret_cast<char*>(lg + 1) + sz)) {
+            munmap(map, len);
+            return nullptr;
+        }
+        arena->large = lg;
+        return lg + 1;
+    } else if (!b) {
+        if (!(b = m61_memory_buffer::create(options.huge_pages))) {
+            return nullptr;
+        }
+        std::lock_guard guard(heap_lock);
+        if (!arena_map_locked(b, m61_buffer_size, b->buffer, b->buffer + b->size)) {
+            b->destroy();
+            return nullptr;
+        }
+        b->prev = arena->cur;
+        arena->cur->next = b;
+    }
+    arena->cur = b;
+    char* p = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(b->buffer) + 15) & ~uintptr_t(15)
+    );
+    arena->pos = p + asz;
+    arena->end = b->buffer + b->size;
+    return p;
+}
+
+
+/// m61_arena_create(file, line)
+///    Returns a new, empty arena, or `nullptr` if out of memory. Memory
+///    allocated from the arena is charged to `file`:`line`.
+
+m61_arena* m61_arena_create(const char* file, int line) {
+    options_init();
+    m61_memory_buffer* b = m61_memory_buffer::create(options.huge_pages);
+    std::unique_lock guard(heap_lock);
+    if (!b || !arena_map_locked(b, m61_buffer_size, b->buffer, b->buffer + b->size)) {
+        if (b) {
+            b->destroy();
+        }
+        guard.unlock();
+        note_failure(sizeof(m61_arena));
+        return nullptr;
+    }
+    m61_arena* arena = new (b->buffer) m61_arena;
+    arena->first = arena->cur = b;
+    arena->pos = arena_start(arena);
+    arena->end = b->buffer + b->size;
+    arena->large = nullptr;
+    arena->site = nullptr;
+    arena->nactive = arena->active_size = 0;
+    arena->prev = nullptr;
+    arena->next = arenas;
+    if (arenas) {
+        arenas->prev = arena;
+    }
+    arenas = arena;
+    guard.unlock();
+
+    if (!options.sample_interval) {
+        arena->site = site_find(file, line);
+    }
+    return arena;
+}
+
+
+/// m61_arena_alloc(arena, sz)
+///    Returns a pointer to `sz` bytes of uninitialized memory from `arena`,
+///    or `nullptr` if out of memory. The memory is released when the arena
+///    is reset or destroyed.
+
+void* m61_arena_alloc(m61_arena* arena, size_t sz) {
+    if (sz > m61_max_size) {
+        note_failure(sz);
+        return nullptr;
+    }
+    size_t asz = (std::max(sz, size_t(1)) + 15) & ~size_t(15);
+    char* p = arena->pos;
+    if (asz <= size_t(arena->end - p)) {
+        arena->pos = p + asz;
+    } else if (!(p = reinterpret_cast<char*>(arena_alloc_slow(arena, sz, asz)))) {
+        note_failure(sz);
+        return nullptr;
+    }
+    ++arena->nactive;
+    arena->active_size += sz;
+    stats_update(arena->site ? arena->site->id : m61_no_site, 1, sz, 1, 0, sz);
+    return p;
+}
+
+
+/// m61_arena_reset(arena)
+///    Frees everything allocated from `arena`. The arena keeps its buffers
+///    for reuse; only large allocations are returned to the OS.
+
+void m61_arena_reset(m61_arena* arena) {
+    stats_update(arena->site ? arena->site->id : m61_no_site,
+                 -(long long) arena->nactive, -(long long) arena->active_size,
+                 0, 0, 0);
+    arena->nactive = arena->active_size = 0;
+    if (arena->large) {
+        std::lock_guard guard(heap_lock);
+        while (m61_arena_large* lg = arena->large) {
+            arena->large = lg->next;
+            arena_unmap_locked(lg, lg->mapsize);
+        }
+    }
+    arena->cur = arena->first;
+    arena->pos = arena_start(arena);
+    arena->end = arena->first->buffer + arena->first->size;
+}
+
+
+/// m61_arena_destroy(arena)
+///    Frees everything allocated from `arena`, and `arena` itself. If
+///    `arena == nullptr`, does nothing.
+
+void m61_arena_destroy(m61_arena* arena) {
+    if (!arena) {
+        return;
+    }
+    m61_arena_reset(arena);
+    std::lock_guard guard(heap_lock);
+    if (arena->prev) {
+        arena->prev->next = arena->next;
+    } else {
+        arenas = arena->next;
+    }
+    if (arena->next) {
+        arena->next->prev = arena->prev;
+    }
+    m61_memory_buffer* b = arena->first;
+    while (b) {
+        m61_memory_buffer* next = b->next;
+        arena_unmap_locked(b, m61_buffer_size);
+        b = next;
+    }
+}
+
+
+// huge_page_coverage(stats)
+//    Set `stats->heap_resident` and `stats->heap_huge` from
+//    /proc/self/smaps, counting the mappings whose first page is in the
+//    page map. Reads the file with system calls and a stack buffer, since
+//    the C library's allocator may be m61 itself (see m61-preload.cc).
+static void huge_page_coverage(m61_statistics* stats) {
+    int fd = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    char buf[4096];
+    size_t len = 0;
+    bool heap = false;
+    while (true) {
+        char* nl = static_cast<char*>(memchr(buf, '\n', len));
+        if (!nl) {
+            ssize_t r = len < sizeof(buf) ? read(fd, buf + len, sizeof(buf) - len) : 0;
+            if (r <= 0) {
+                break;
+            }
+            len += r;
+            continue;
+        }
+        *nl = '\0';
+        unsigned long long start, end, kb;
+        if (sscanf(buf, "%llx-%llx", &start, &end) == 2) {
+            heap = pagemap_lookup(reinterpret_cast<void*>(start)) != 0;
+        } else if (heap && sscanf(buf, "Rss: %llu kB", &kb) == 1) {
+            stats->heap_resident += kb << 10;
+        } else if (heap && sscanf(buf, "AnonHugePages: %llu kB", &kb) == 1) {
+            stats->heap_huge += kb << 10;
+        }
+        len -= nl + 1 - buf;
+        memmove(buf, nl + 1, len);
+    }
+    close(fd);
+}
+
+
 /// m61_get_statistics()
 ///    Return the current memory statistics.
 
 m61_statistics m61_get_statistics() {
-    // Your code here.
-    // The handout code sets all statistics to enormous numbers.
     m61_statistics stats;
-    memset(&stats, 255, sizeof(m61_statistics));
+    memset(&stats, 0, sizeof(stats));
+
+    // Sum the shards. Each shard is a seqlock, so one read of it is
+    // consistent. Shard sequence numbers only grow, so if no shard's number
+    // (and no new shard) appeared during a pass, the pass saw a single
+    // moment: retry until one does. A thread that never stops allocating can
+    // keep that from happening, so after enough tries settle for per-shard
+    // consistency, where a free counted in one shard can be seen without the
+    // allocation it undoes in another.
+    unsigned long long v[6];
+    auto sum_shard = [&] (m61_stat_shard* sh) {
+        unsigned long long w[6];
+        unsigned s1, s2;
+        do {
+            s1 = sh->seq.load(std::memory_order_acquire);
+            w[0] = sh->nactive.load(std::memory_order_relaxed);
+            w[1] = sh->active_size.load(std::memory_order_relaxed);
+            w[2] = sh->ntotal.load(std::memory_order_relaxed);
+            w[3] = sh->total_size.load(std::memory_order_relaxed);
+            w[4] = sh->nfail.load(std::memory_order_relaxed);
+            w[5] = sh->fail_size.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s2 = sh->seq.load(std::memory_order_relaxed);
+        } while ((s1 & 1) || s1 != s2);
+        for (int i = 0; i != 6; ++i) {
+            v[i] += w[i];
+        }
+        return s1;
+    };
+    bool consistent = false;
+    for (int tries = 0; !consistent && tries != 1000; ++tries) {
+        if (tries != 0) {
+            sched_yield();
+        }
+        memset(v, 0, sizeof(v));
+        m61_stat_shard* head = stat_shards.load(std::memory_order_acquire);
+        unsigned long long seqs = sum_shard(&orphan_shard);
+        for (m61_stat_shard* sh = head; sh; sh = sh->next) {
+            seqs += sum_shard(sh);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        unsigned long long seqs2 = orphan_shard.seq.load(std::memory_order_relaxed);
+        for (m61_stat_shard* sh = head; sh; sh = sh->next) {
+            seqs2 += sh->seq.load(std::memory_order_relaxed);
+        }
+        consistent = seqs == seqs2
+            && stat_shards.load(std::memory_order_relaxed) == head;
+    }
+    stats.nactive = v[0];
+    stats.active_size = v[1];
+    stats.ntotal = v[2];
+    stats.total_size = v[3];
+    stats.nfail = v[4];
+    stats.fail_size = v[5];
+    if (!consistent
+        && ((long long) stats.nactive < 0 || (long long) stats.active_size < 0)) {
+        stats.nactive = stats.active_size = 0;
+    }
+    if (options.huge_pages) {
+        huge_page_coverage(&stats);
+    }
+
+    std::lock_guard guard(heap_lock);
+    stats.heap_min = heap_min;
+    stats.heap_max = heap_max;
+
+    // External fragmentation: the fraction of free memory that is not in
+    // the largest free block. The largest block is in the highest nonempty
+    // bin.
+    stats.free_size = free_size;
+    stats.largest_free = 0;
+    for (unsigned c = m61_nclasses; c != 0 && !stats.largest_free; --c) {
+        for (m61_free_block* fb = bins[c - 1]; fb; fb = fb->next) {
+            stats.largest_free = std::max<unsigned long long>(
+                stats.largest_free, block_size(&fb->hdr)
+            );
+        }
+    }
+    stats.fragmentation = free_size ? 1 - double(stats.largest_free) / free_size : 0;
     return stats;
 }
 
 
+/// m61_check_canaries()
+///    Checks the canaries of all live blocks, and the poison of all
+///    quarantined blocks. If one has been overwritten, reports the wild
+///    write (or write after free) and aborts. With
+///    `M61_LAZY_CANARIES=1` this is the only canary check (apart from
+///    `m61_print_statistics`, which calls it), so frees stay cheap but
+///    wild writes are caught late, and only in blocks still live.
+
+void m61_check_canaries() {
+    auto check = [] (m61_header* hdr) {
+        if (!canary_ok(hdr)) {
+            m61_site* site = block_site(hdr);
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write past end of object %p with size %zu\n",
+                    site && site->file ? site->file : "?", site ? site->line : 0,
+                    static_cast<void*>(hdr + 1), block_request_size(hdr));
+            abort();
+        }
+    };
+    std::lock_guard guard(heap_lock);
+    for (m61_memory_buffer* b = buffers; b; b = b->next) {
+        for (m61_header* hdr = reinterpret_cast<m61_header*>(b->buffer);
+             block_size(hdr) != 0;
+             hdr = next_block(hdr)) {
+            // Skip free blocks and blocks in thread caches. The owner can
+            // free and reuse a block while we look, so a bad canary counts
+            // only if the block is still live, with the same tag, and its
+            // canary still bad, when checked again.
+            uint8_t* st = state_entry(hdr + 1);
+            size_t tag = load_tag(hdr);
+            if ((tag & M61_INUSE)
+                && __atomic_load_n(st, __ATOMIC_ACQUIRE) == M61_STATE_LIVE
+                && !canary_ok(hdr)
+                && __atomic_load_n(st, __ATOMIC_ACQUIRE) == M61_STATE_LIVE
+                && load_tag(hdr) == tag) {
+                check(hdr);
+            }
+        }
+    }
+    for (m61_large_block* lb = large_blocks; lb; lb = lb->next) {
+        check(&lb->hdr);
+    }
+    for (size_t i = 0; i != quarantine.count; ++i) {
+        check_poison(quarantine.ring[(quarantine.head + i) % m61_quarantine_slots]);
+    }
+}
+
+
 /// m61_print_statistics()
 ///    Prints the current memory statistics.
 
 void m61_print_statistics() {
+    if (options.lazy_canaries) {
+        m61_check_canaries();
+    }
     m61_statistics stats = m61_get_statistics();
     printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
            stats.nactive, stats.ntotal, stats.nfail);
     printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
            stats.active_size, stats.total_size, stats.fail_size);
+    if (options.huge_pages) {
+        printf("huge pages:  %llu of %llu resident heap bytes (%.1f%%)\n",
+               stats.heap_huge, stats.heap_resident,
+               stats.heap_resident ? 100.0 * stats.heap_huge / stats.heap_resident : 0.0);
+    }
 }
 
 
@@ -117,5 +2925,107 @@ void m61_print_statistics() {
 ///    memory.
 
 void m61_print_leak_report() {
-    // Your code here.
+    // The site table tells whether anything is live without a heap walk
+    bool any = false;
+    for_each_site([&] (m61_site* site) {
+        any = any || (long long) site_totals(site).nactive > 0;
+    });
+    if (!any) {
+        return;
+    }
+
+    auto report = [] (m61_header* hdr) {
+        // Cached and quarantined blocks are in use but not live
+        size_t tag = load_tag(hdr);
+        if ((tag & M61_INUSE) && (tag & M61_SITE)
+            && ((tag & M61_MMAPPED)
+                || __atomic_load_n(state_entry(hdr + 1), __ATOMIC_ACQUIRE) == M61_STATE_LIVE)) {
+            m61_site* site = block_site(hdr);
+            printf("LEAK CHECK: %s:%d: allocated object %p with size %zu\n",
+                   site->file ? site->file : "?", site->line,
+                   static_cast<void*>(hdr + 1), block_request_size(hdr));
+        }
+    };
+    std::lock_guard guard(heap_lock);
+    for (m61_memory_buffer* b = buffers; b; b = b->next) {
+        for (m61_header* hdr = reinterpret_cast<m61_header*>(b->buffer);
+             block_size(hdr) != 0;
+             hdr = next_block(hdr)) {
+            report(hdr);
+        }
+    }
+    for (m61_large_block* lb = large_blocks; lb; lb = lb->next) {
+        report(&lb->hdr);
+    }
+    m61_site** sites = site_list.load(std::memory_order_acquire);
+    for (size_t s = 0; s != pool_nslabs; ++s) {
+        m61_pool_slab& slab = pool_slabs[s];
+        char* base = pool_region + s * m61_pool_slab_size;
+        for (size_t i = 0; i != m61_pool_slab_size / slab.object_size; ++i) {
+            if (slab.meta[i].site != m61_no_site) {
+                m61_site* site = sites[slab.meta[i].site];
+                printf("LEAK CHECK: %s:%d: allocated object %p with size %u\n",
+                       site->file ? site->file : "?", site->line,
+                       static_cast<void*>(base + i * slab.object_size),
+                       slab.meta[i].size);
+            }
+        }
+    }
+    for (m61_arena* arena = arenas; arena; arena = arena->next) {
+        if (arena->site && arena->nactive) {
+            printf("LEAK CHECK: %s:%d: allocated arena %p with %llu objects of total size %llu\n",
+                   arena->site->file ? arena->site->file : "?", arena->site->line,
+                   static_cast<void*>(arena), arena->nactive, arena->active_size);
+        }
+    }
+}
+
+
+/// m61_print_heap_profile(f)
+///    Prints the active bytes allocated at each site to `f` in
+///    collapsed-stack format (`FILE:LINE BYTES`), which flame graph tools
+///    read. With sampling on, the byte counts are estimates.
+
+void m61_print_heap_profile(FILE* f) {
+    for_each_site([&] (m61_site* site) {
+        long long bytes = site_totals(site).active_size;
+        if (bytes > 0) {
+            fprintf(f, "%s:%d %lld\n",
+                    site->file ? site->file : "?", site->line, bytes);
+        }
+    });
+}
+
+
+/// m61_print_heavy_hitter_report()
+///    Prints the allocation sites responsible for at least 10% of all
+///    allocated bytes, heaviest first.
+
+void m61_print_heavy_hitter_report() {
+    unsigned long long total = 0;
+    for_each_site([&] (m61_site* site) {
+        total += site_totals(site).total_size;
+    });
+
+    // At most 10 sites can each account for 10% of the total
+    std::pair<unsigned long long, m61_site*> hitters[10];
+    size_t nhitters = 0;
+    for_each_site([&] (m61_site* site) {
+        unsigned long long bytes = site_totals(site).total_size;
+        if (bytes != 0 && bytes * 10 >= total && nhitters != 10) {
+            size_t i = nhitters;
+            for (; i != 0 && hitters[i - 1].first < bytes; --i) {
+                hitters[i] = hitters[i - 1];
+            }
+            hitters[i] = {bytes, site};
+            ++nhitters;
+        }
+    });
+
+    for (size_t i = 0; i != nhitters; ++i) {
+        m61_site* site = hitters[i].second;
+        printf("HEAVY HITTER: %s:%d: %llu bytes (~%.1f%%)\n",
+               site->file ? site->file : "?", site->line, hitters[i].first,
+               100.0 * hitters[i].first / total);
+    }
 }
@@ -3,7 +3,10 @@
 #include <cassert>
 #include <cstdlib>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <initializer_list>
 #include <new>
 #include <random>
 
@@ -22,6 +25,34 @@ void m61_free(void* ptr, const char* file = __builtin_FILE(), int line = __built
 ///    is initialized to zero.
 void* m61_calloc(size_t count, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_realloc(ptr, sz, file, line)
+///    Change the size of the dynamic allocation pointed to by `ptr` to
+///    `sz` bytes, preserving its contents, and return a pointer to the
+///    resized allocation (which may have moved). Grows in place when
+///    possible.
+void* m61_realloc(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to a multiple of `align`, which must be a power of two.
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_memalign(align, sz, file, line)
+///    Same as `m61_aligned_alloc`.
+void* m61_memalign(size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_usable_size(ptr, file, line)
+///    Return the number of bytes usable at `ptr`, which may exceed the size
+///    requested; the caller may use them all. Returns 0 for `nullptr`.
+size_t m61_usable_size(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_fork_prepare(), m61_fork_parent(), m61_fork_child()
+///    Handlers for `pthread_atfork`, which keep a multithreaded program
+///    that forks from deadlocking in the child on an allocator lock.
+void m61_fork_prepare();
+void m61_fork_parent();
+void m61_fork_child();
+
 
 /// m61_statistics
 ///    Structure tracking memory statistics.
@@ -34,38 +65,185 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     uintptr_t heap_min;                 // smallest allocated addr
     uintptr_t heap_max;                 // largest allocated addr
+    unsigned long long free_size;       // # bytes in free heap blocks
+    unsigned long long largest_free;    // # bytes in largest free block
+    double fragmentation;               // 1 - largest_free / free_size
+    unsigned long long heap_resident;   // # resident bytes in heap mappings
+    unsigned long long heap_huge;       // # of those in huge pages
 };
 
 /// m61_get_statistics()
-///    Return the current memory statistics.
+///    Return the current memory statistics. `heap_resident` and `heap_huge`
+///    are measured only if the environment variable `M61_HUGE_PAGES=1`
+///    asks for transparent huge pages. The counts are a snapshot of a single
+///    moment unless other threads allocate and free too busily to take one;
+///    then each thread's counts are consistent, but `nactive` may briefly
+///    miss an allocation whose free another thread has counted (it is never
+///    reported negative).
 m61_statistics m61_get_statistics();
 
 /// m61_print_statistics()
 ///    Print the current memory statistics.
 void m61_print_statistics();
 
+/// m61_check_canaries()
+///    Check all live blocks for writes past their ends, reporting the first
+///    one found and aborting. Normally each block is checked when it is
+///    freed; with `M61_LAZY_CANARIES=1` in the environment, blocks are
+///    checked only by this function (which `m61_print_statistics` calls).
+///    Also checks blocks held in quarantine (`M61_QUARANTINE=N`) for
+///    writes after free.
+void m61_check_canaries();
+
 /// m61_print_leak_report()
 ///    Print a report of all currently-active allocated blocks of dynamic
 ///    memory.
 void m61_print_leak_report();
 
+/// m61_print_heavy_hitter_report()
+///    Print the allocation sites responsible for the most allocated bytes.
+void m61_print_heavy_hitter_report();
+
+/// m61_print_heap_profile(f)
+///    Print the active bytes allocated at each site to `f`, in the
+///    collapsed-stack format read by flame graph tools. If the environment
+///    variable `M61_SAMPLE_INTERVAL` is set to N, only about one allocation
+///    per N bytes allocated is recorded, and all per-site counts (here and
+///    in the other reports) are estimates extrapolated from the samples.
+void m61_print_heap_profile(FILE* f = stdout);
+
+
+/// m61_trace_record
+///    One event in an allocation trace. If the environment variable
+///    `M61_TRACE` names a file, every call to `m61_malloc`, `m61_free`,
+///    `m61_calloc`, `m61_realloc`, and `m61_aligned_alloc` appends a record
+///    to that file; `bench-replay` replays the result. Pointer ids are the
+///    addresses returned and freed (0 for a failed allocation). Each site
+///    is described once, by an `M61_TRACE_SITE` record whose `size` is the
+///    site's line and which is followed by `arg` bytes of file name, padded
+///    with zeros to a multiple of 8. Each thread's records are written in
+///    batches, so the file is ordered only within a thread; `time` orders
+///    events globally. A realloc frees its old id at `time` and allocates
+///    its new id at `end_time`; for other events the two are equal. A
+///    batch is written when full and when its thread exits, so records are
+///    lost if the process ends with `_exit`.
+struct m61_trace_record {
+    uint8_t op;                  // `M61_TRACE_` constant
+    uint8_t reserved;
+    uint16_t thread;             // thread number, from 1
+    uint32_t site;               // site id
+    uint64_t time;               // ns since tracing began
+    uint64_t size;               // requested size (calloc: element size)
+    uint64_t ptr;                // returned pointer id (free: freed id)
+    uint64_t arg;                // realloc: old id; calloc: count;
+                                 // aligned_alloc: alignment
+    uint64_t end_time;           // realloc: ns when it returned; else `time`
+};
+
+enum : uint8_t {
+    M61_TRACE_SITE = 1, M61_TRACE_MALLOC, M61_TRACE_FREE, M61_TRACE_CALLOC,
+    M61_TRACE_REALLOC, M61_TRACE_ALIGNED_ALLOC
+};
+
+
+/// m61_pool_alloc(sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    from a pool of same-size objects. `sz` must be at most
+///    `m61_pool_max_size`. Pool objects have no per-object header and are
+///    carved from slabs in bulk, which suits container nodes.
+inline constexpr size_t m61_pool_max_size = 256;
+void* m61_pool_alloc(size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_pool_free(ptr, file, line)
+///    Free a pointer returned by `m61_pool_alloc`.
+void m61_pool_free(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+
+/// m61_arena
+///    A region of memory for objects that are freed together. Allocation
+///    from an arena is a pointer bump; `m61_arena_reset` frees all of an
+///    arena's objects at once. Arena memory counts in `m61_statistics`. An
+///    arena must not be used by two threads at once.
+struct m61_arena;
+
+/// m61_arena_create(file, line)
+///    Return a new, empty arena, or `nullptr` if out of memory. Memory
+///    allocated from the arena is charged to `file`:`line`.
+m61_arena* m61_arena_create(const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_arena_alloc(arena, sz)
+///    Return a pointer to `sz` bytes of uninitialized memory from `arena`,
+///    aligned like `m61_malloc` memory. Arena memory must not be passed to
+///    `m61_free`; it is freed when the arena is reset or destroyed.
+void* m61_arena_alloc(m61_arena* arena, size_t sz);
+
+/// m61_arena_reset(arena)
+///    Free all memory allocated from `arena`, which can then be reused.
+void m61_arena_reset(m61_arena* arena);
+
+/// m61_arena_destroy(arena)
+///    Free all memory allocated from `arena`, and the arena itself.
+void m61_arena_destroy(m61_arena* arena);
+
 
 /// This magic class lets standard C++ containers use your allocator
-/// instead of the system allocator.
+/// instead of the system allocator. Single objects (such as the nodes of
+/// `std::map` and `std::list`) come from the pool allocator. Allocations
+/// are charged to the place the allocator was constructed; construct one
+/// in your own code and pass it to the container to see that location in
+/// leak reports. An allocator the container constructs itself would be
+/// charged to a line of a standard library header, which says nothing
+/// about the caller, so its allocations are reported at an unknown site
+/// (`?`) instead.
 template <typename T>
 class m61_allocator {
 public:
     using value_type = T;
-    m61_allocator() noexcept = default;
+    // `explicit` so a `const char*` cannot silently convert to an allocator
+    explicit m61_allocator(const char* file = __builtin_FILE(),
+                           int line = __builtin_LINE()) noexcept
+        : file_(system_file(file) ? nullptr : file), line_(file_ ? line : 0) {
+    }
     m61_allocator(const m61_allocator<T>&) noexcept = default;
-    template <typename U> m61_allocator(m61_allocator<U>&) noexcept {}
+    template <typename U> m61_allocator(const m61_allocator<U>& x) noexcept
+        : file_(x.file_), line_(x.line_) {
+    }
 
     T* allocate(size_t n) {
-        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
+        if (n == 1 && use_pool) {
+            return reinterpret_cast<T*>(m61_pool_alloc(sizeof(T), file_, line_));
+        }
+        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), file_, line_));
     }
-    void deallocate(T* ptr, size_t) {
-        m61_free(ptr, "?", 0);
+    void deallocate(T* ptr, size_t n) {
+        if (n == 1 && use_pool) {
+            m61_pool_free(ptr, file_, line_);
+        } else {
+            m61_free(ptr, file_, line_);
+        }
     }
+
+private:
+    static constexpr bool use_pool = sizeof(T) <= m61_pool_max_size
+        && alignof(T) <= alignof(std::max_align_t);
+
+    // system_file(file)
+    //    Return true if `file` looks like a system or standard library
+    //    header.
+    static bool system_file(const char* file) noexcept {
+        for (const char* prefix : {"/usr/include/", "/usr/lib/",
+                                   "/usr/local/include/", "/opt/",
+                                   "/Library/Developer/", "/Applications/Xcode"}) {
+            if (strncmp(file, prefix, strlen(prefix)) == 0) {
+                return true;
+            }
+        }
+        return strstr(file, "/include/c++/") != nullptr;
+    }
+    const char* file_;
+    int line_;
+
+    template <typename U> friend class m61_allocator;
 };
 template <typename T, typename U>
 inline constexpr bool operator==(const m61_allocator<T>&, const m61_allocator<U>&) {
@@ -0,0 +1,40 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that freed neighbors coalesce and fragmentation is reported.
+
+int main() {
+    constexpr int nptrs = 80;
+    char* ptrs[nptrs];
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = (char*) m61_malloc(1500);
+        assert(ptrs[i]);
+    }
+
+    // free every other block: free space is fragmented
+    for (int i = 0; i < nptrs; i += 2) {
+        m61_free(ptrs[i]);
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.free_size > stat.largest_free);
+    printf("fragmented: %s\n", stat.fragmentation > 0 ? "yes" : "no");
+
+    // free the rest: neighbors merge into one free block
+    for (int i = 1; i < nptrs; i += 2) {
+        m61_free(ptrs[i]);
+    }
+    stat = m61_get_statistics();
+    assert(stat.free_size == stat.largest_free);
+    printf("fragmented: %s\n", stat.fragmentation > 0 ? "yes" : "no");
+
+    // the merged space can satisfy one big request
+    char* big = (char*) m61_malloc(nptrs * 1500);
+    assert(big == ptrs[0]);
+    m61_free(big);
+    m61_print_statistics();
+}
+
+//! fragmented: yes
+//! fragmented: no
+//! alloc count: active          0   total         81   fail          0
+//! alloc size:  active          0   total     240000   fail          0
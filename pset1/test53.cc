@@ -0,0 +1,33 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+// Check that M61_COALESCE=0 turns off coalescing.
+
+int main() {
+    // options are read when the heap is first used
+    setenv("M61_COALESCE", "0", 1);
+
+    constexpr int nptrs = 80;
+    char* ptrs[nptrs];
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = (char*) m61_malloc(1500);
+        assert(ptrs[i]);
+    }
+    for (int i = 0; i != nptrs; ++i) {
+        m61_free(ptrs[i]);
+    }
+
+    m61_statistics stat = m61_get_statistics();
+    printf("fragmented: %s\n", stat.fragmentation > 0 ? "yes" : "no");
+
+    // without coalescing, the freed blocks cannot serve a big request
+    char* big = (char*) m61_malloc(nptrs * 1500);
+    assert(big != ptrs[0]);
+    m61_free(big);
+    m61_print_statistics();
+}
+
+//! fragmented: yes
+//! alloc count: active          0   total         81   fail          0
+//! alloc size:  active          0   total     240000   fail          0
@@ -0,0 +1,30 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+// Check that large allocations get their own mappings.
+
+int main() {
+    constexpr size_t size = 4 << 20;
+    char* p = (char*) m61_calloc(size / 4, 4);
+    assert(p);
+    for (size_t i = 0; i != size; ++i) {
+        assert(p[i] == 0);
+    }
+    memset(p, 'x', size);
+
+    // after m61_free, the pages are no longer mapped
+    void* page = (void*) ((uintptr_t) p & ~uintptr_t(4095));
+    unsigned char vec;
+    assert(mincore(page, 4096, &vec) == 0);
+    m61_free(p);
+    int r = mincore(page, 4096, &vec);
+    printf("unmapped: %s\n", r == -1 && errno == ENOMEM ? "yes" : "no");
+    m61_print_statistics();
+}
+
+//! unmapped: yes
+//! alloc count: active          0   total          1   fail          0
+//! alloc size:  active          0   total    4194304   fail          0
@@ -0,0 +1,48 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Check that statistics snapshots are consistent while threads allocate.
+
+static std::atomic<bool> done;
+
+static void churn_thread() {
+    void* ptrs[8] = {};
+    for (int i = 0; i != 100000; ++i) {
+        int slot = i % 8;
+        m61_free(ptrs[slot]);
+        ptrs[slot] = m61_malloc(100);
+        assert(ptrs[slot]);
+    }
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+}
+
+int main() {
+    std::vector<std::thread> th;
+    for (int i = 0; i != 4; ++i) {
+        th.emplace_back(churn_thread);
+    }
+    std::thread watcher([] () {
+        while (!done) {
+            // every allocation has size 100, so a consistent snapshot
+            // always has `active_size == 100 * nactive`
+            m61_statistics stat = m61_get_statistics();
+            assert(stat.active_size == 100 * stat.nactive);
+            assert(stat.nactive <= 4 * 8);
+            assert(stat.total_size == 100 * stat.ntotal);
+        }
+    });
+    for (auto& t : th) {
+        t.join();
+    }
+    done = true;
+    watcher.join();
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total     400000   fail          0
+//! alloc size:  active          0   total   40000000   fail          0
@@ -0,0 +1,17 @@
+#include "m61.hh"
+#include <cstdio>
+// Check heavy-hitter report: sites with at least 10% of all allocated
+// bytes, heaviest first. No leak report when nothing is active.
+
+int main() {
+    for (int i = 0; i != 1000; ++i) {
+        m61_free(m61_malloc(250));
+        m61_free(m61_malloc(700));
+        m61_free(m61_malloc(50));
+    }
+    m61_print_heavy_hitter_report();
+    m61_print_leak_report();
+}
+
+//! HEAVY HITTER: test???.cc:9: 700000 bytes (~70.0%)
+//! HEAVY HITTER: test???.cc:8: 250000 bytes (~25.0%)
@@ -0,0 +1,46 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+// Check sampled heap profile: with M61_SAMPLE_INTERVAL set, per-site
+// counts are extrapolated from a sample and should be close to the truth.
+
+void* live[10000];
+
+int main() {
+    setenv("M61_SAMPLE_INTERVAL", "4096", 1);
+    for (int i = 0; i != 200000; ++i) {
+        m61_free(m61_malloc(64));
+    }
+    for (int i = 0; i != 10000; ++i) {
+        live[i] = m61_malloc(256);
+    }
+    m61_print_statistics();
+
+    // Read the profile back and compare the estimate for line 16
+    char* buf;
+    size_t bufsz;
+    FILE* f = open_memstream(&buf, &bufsz);
+    m61_print_heap_profile(f);
+    fclose(f);
+    long long est = 0;
+    for (char* line = strtok(buf, "\n"); line; line = strtok(nullptr, "\n")) {
+        int lineno;
+        long long bytes;
+        if (sscanf(line, "test%*2d.cc:%d %lld", &lineno, &bytes) == 2) {
+            assert(lineno == 16);
+            est = bytes;
+        }
+    }
+    free(buf);
+    printf("estimate within 20%%: %s\n",
+           fabs(est - 2560000.0) < 0.2 * 2560000 ? "yes" : "no");
+
+    for (int i = 0; i != 10000; ++i) {
+        m61_free(live[i]);
+    }
+}
+
+//! alloc count: active      10000   total     210000   fail          0
+//! alloc size:  active    2560000   total   15360000   fail          0
+//! estimate within 20%: yes
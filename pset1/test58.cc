@@ -0,0 +1,25 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check that small allocations are compact: a 16-byte allocation should
+// cost no more than 32 bytes of heap.
+
+void* ptrs[10000];
+
+int main() {
+    for (int i = 0; i != 10000; ++i) {
+        ptrs[i] = m61_malloc(16);
+        assert(reinterpret_cast<uintptr_t>(ptrs[i]) % 16 == 0);
+    }
+    m61_statistics stat = m61_get_statistics();
+    size_t span = stat.heap_max - stat.heap_min;
+    printf("bytes per allocation: %s\n", span <= 10000 * 32 + 4096 ? "<= 32" : "> 32");
+    for (int i = 0; i != 10000; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_print_statistics();
+}
+
+//! bytes per allocation: <= 32
+//! alloc count: active          0   total      10000   fail          0
+//! alloc size:  active          0   total     160000   fail          0
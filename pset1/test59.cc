@@ -0,0 +1,52 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check m61_realloc: contents survive, and blocks grow and shrink in place
+// when they can.
+
+int main() {
+    // A fresh block is followed by free space, so it can grow in place
+    char* p = (char*) m61_malloc(2000);
+    memset(p, 'a', 2000);
+    char* q = (char*) m61_realloc(p, 6000);
+    printf("grew in place: %s\n", q == p ? "yes" : "no");
+    for (int i = 0; i != 2000; ++i) {
+        assert(q[i] == 'a');
+    }
+    memset(q, 'b', 6000);
+
+    // Shrinking never moves
+    p = (char*) m61_realloc(q, 100);
+    printf("shrank in place: %s\n", p == q ? "yes" : "no");
+    for (int i = 0; i != 100; ++i) {
+        assert(p[i] == 'b');
+    }
+
+    // A block hemmed in by another allocation must move
+    char* fence = (char*) m61_malloc(2000);
+    q = (char*) m61_realloc(p, 3000);
+    printf("moved: %s\n", q != p ? "yes" : "no");
+    for (int i = 0; i != 100; ++i) {
+        assert(q[i] == 'b');
+    }
+
+    // Large blocks are remapped
+    char* big = (char*) m61_realloc(nullptr, 1 << 20);
+    memset(big, 'c', 1 << 20);
+    big = (char*) m61_realloc(big, 16 << 20);
+    for (int i = 0; i != (1 << 20); ++i) {
+        assert(big[i] == 'c');
+    }
+
+    assert(m61_realloc(fence, 0) == nullptr);
+    m61_free(big);
+    m61_free(q);
+    m61_print_statistics();
+}
+
+//! grew in place: yes
+//! shrank in place: yes
+//! moved: yes
+//! alloc count: active          0   total          7   fail          0
+//! alloc size:  active          0   total   ??{\d+}??   fail          0
@@ -0,0 +1,46 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+// Check m61_aligned_alloc and m61_memalign.
+
+void* ptrs[1000];
+
+int main() {
+    for (size_t align = 1; align <= (size_t(1) << 22); align *= 2) {
+        for (size_t sz : {size_t(1), size_t(100), size_t(5000), size_t(1) << 20}) {
+            char* p = (char*) m61_aligned_alloc(align, sz);
+            assert(p && reinterpret_cast<uintptr_t>(p) % align == 0);
+            memset(p, 'x', sz);
+            m61_free(p);
+        }
+        char* p = (char*) m61_memalign(align, 10);
+        assert(p && reinterpret_cast<uintptr_t>(p) % align == 0);
+        m61_free(p);
+    }
+
+    // Cache-line-aligned blocks pack tightly: the skipped space is reused
+    for (int i = 0; i != 1000; ++i) {
+        ptrs[i] = m61_aligned_alloc(64, 64);
+        assert(reinterpret_cast<uintptr_t>(ptrs[i]) % 64 == 0);
+    }
+    uintptr_t lo = UINTPTR_MAX, hi = 0;
+    for (int i = 0; i != 1000; ++i) {
+        lo = std::min(lo, reinterpret_cast<uintptr_t>(ptrs[i]));
+        hi = std::max(hi, reinterpret_cast<uintptr_t>(ptrs[i]));
+    }
+    printf("bytes per allocation: %s\n", hi - lo <= 1000 * 128 ? "<= 128" : "> 128");
+    for (int i = 0; i != 1000; ++i) {
+        m61_free(ptrs[i]);
+    }
+
+    // Invalid alignments fail
+    assert(!m61_aligned_alloc(3, 10));
+    assert(!m61_aligned_alloc(0, 10));
+    m61_print_statistics();
+}
+
+//! bytes per allocation: <= 128
+//! alloc count: active          0   total       1115   fail          2
+//! alloc size:  active          0   total ??{\d+}??   fail         20
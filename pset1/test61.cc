@@ -0,0 +1,42 @@
+#include "m61.hh"
+#include <cstdio>
+#include <list>
+#include <map>
+// Check container allocations from pools: nodes count in statistics, and
+// leaked nodes are reported at the allocator's construction site, or at
+// an unknown site if the container constructed the allocator itself.
+
+int main() {
+    m61_allocator<int> alloc;
+    {
+        std::list<int, m61_allocator<int>> l(alloc);
+        for (int i = 0; i != 1000; ++i) {
+            l.push_back(i);
+        }
+        m61_print_statistics();
+    }
+
+    // Leak a map with two nodes
+    using map_type = std::map<int, int, std::less<int>,
+                              m61_allocator<std::pair<const int, int>>>;
+    alignas(map_type) static char buf[sizeof(map_type)];
+    map_type* m = new (buf) map_type(alloc);
+    (*m)[1] = 1;
+    (*m)[2] = 2;
+
+    // Leak a map whose allocator is constructed inside the library
+    alignas(map_type) static char buf2[sizeof(map_type)];
+    map_type* m2 = new (buf2) map_type;
+    (*m2)[3] = 3;
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//! alloc count: active       1000   total       1000   fail          0
+//! alloc size:  active ??{\s*\d+}??   total ??{\s*\d+}??   fail          0
+//! alloc count: active          3   total       1003   fail          0
+//! alloc size:  active ??{\s*\d+}??   total ??{\s*\d+}??   fail          0
+//!!UNORDERED
+//! LEAK CHECK: test???.cc:10: allocated object ??{\w+}?? with size ??{\d+}??
+//! LEAK CHECK: test???.cc:10: allocated object ??{\w+}?? with size ??{\d+}??
+//! LEAK CHECK: ?:0: allocated object ??{\w+}?? with size ??{\d+}??
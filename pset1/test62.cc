@@ -0,0 +1,41 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+// Check arenas: bump allocation, statistics, reset, and leak reports.
+
+int main() {
+    m61_arena* arena = m61_arena_create();
+    assert(arena);
+    for (int i = 0; i != 1000; ++i) {
+        char* p = (char*) m61_arena_alloc(arena, i % 50);
+        assert(p && (uintptr_t) p % alignof(std::max_align_t) == 0);
+        memset(p, 'A', i % 50);
+    }
+    // Larger than a buffer, and larger than the mmap threshold
+    char* big = (char*) m61_arena_alloc(arena, 10 << 20);
+    assert(big);
+    memset(big, 'B', 10 << 20);
+    char* mid = (char*) m61_arena_alloc(arena, 200000);
+    assert(mid);
+    m61_print_statistics();
+
+    m61_statistics stat = m61_get_statistics();
+    assert((uintptr_t) big >= stat.heap_min && (uintptr_t) big + (10 << 20) <= stat.heap_max);
+
+    m61_arena_reset(arena);
+    m61_print_statistics();
+
+    // Memory is reused after a reset; leave three objects live
+    for (int i = 0; i != 3; ++i) {
+        m61_arena_alloc(arena, 100);
+    }
+    m61_print_leak_report();
+}
+
+//! alloc count: active       1002   total       1002   fail          0
+//! alloc size:  active   10710260   total   10710260   fail          0
+//! alloc count: active          0   total       1002   fail          0
+//! alloc size:  active          0   total   10710260   fail          0
+//! LEAK CHECK: test???.cc:9: allocated arena ??{\w+}?? with 3 objects of total size 300
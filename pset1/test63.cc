@@ -0,0 +1,15 @@
+#include "m61.hh"
+#include <cstdio>
+// Check double free detection for a block with its own mapping.
+
+int main() {
+    void* ptr = m61_malloc(1 << 20);
+    fprintf(stderr, "Will free %p\n", ptr);
+    m61_free(ptr);
+    m61_free(ptr);
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG: test???.cc:9: invalid free of pointer ??ptr??, double free
+//! ???
@@ -0,0 +1,21 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// Check lazy canary checking: frees do not check, and the statistics scan
+// catches a wild write in a live block.
+
+int main() {
+    setenv("M61_LAZY_CANARIES", "1", 1);
+    char* a = (char*) m61_malloc(10);
+    char* b = (char*) m61_malloc(20);
+    memset(a, 'A', 11);
+    m61_free(a);
+    fprintf(stderr, "Wild write past %p\n", b);
+    memset(b, 'B', 24);
+    m61_print_statistics();
+}
+
+//! Wild write past ??{0x\w+}=ptr??
+//! MEMORY BUG: test???.cc:11: detected wild write past end of object ??ptr?? with size 20
+//! ???
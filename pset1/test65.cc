@@ -0,0 +1,23 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+// Check the quarantine: a write to a freed block is caught when the block
+// leaves quarantine.
+
+int main() {
+    setenv("M61_QUARANTINE", "4096", 1);
+    char* p = (char*) m61_malloc(100);
+    m61_free(p);
+    fprintf(stderr, "Write after free to %p\n", p);
+    p[10] = 'x';
+    // Quarantined blocks are not reused, so this churn pushes `p` out
+    for (int i = 0; i != 64; ++i) {
+        void* q = m61_malloc(200);
+        m61_free(q);
+    }
+    m61_print_statistics();
+}
+
+//! Write after free to ??{0x\w+}=ptr??
+//! MEMORY BUG: detected write to freed object ??ptr?? with size 100, 10 bytes inside
+//! ???
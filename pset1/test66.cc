@@ -0,0 +1,61 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+// Check the allocation trace written with `M61_TRACE`.
+
+int main() {
+    char fname[] = "/tmp/m61trace.XXXXXX";
+    int fd = mkstemp(fname);
+    assert(fd >= 0);
+    close(fd);
+    setenv("M61_TRACE", fname, 1);
+
+    // A thread's trace buffer is written out when the thread exits
+    std::thread t([] {
+        void* p = m61_malloc(100);
+        void* q = m61_calloc(3, 20);
+        p = m61_realloc(p, 200);
+        m61_free(q);
+        m61_free(p);
+    });
+    t.join();
+
+    FILE* f = fopen(fname, "r");
+    assert(f);
+    m61_trace_record r;
+    uint64_t first_ptr = 0;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.op == M61_TRACE_SITE) {
+            char file[1024] = {};
+            size_t n = fread(file, 1, (r.arg + 7) & ~7, f);
+            assert(n == ((r.arg + 7) & ~7));
+            (void) n;
+            printf("site %u: %s:%d\n", r.site, strrchr(file, '/') ? strrchr(file, '/') + 1 : file,
+                   int(r.size));
+        } else {
+            if (!first_ptr) {
+                first_ptr = r.ptr;
+            }
+            printf("op %d thread %d site %u size %d arg %d%s\n",
+                   r.op, r.thread, r.site, int(r.size),
+                   int(r.op == M61_TRACE_REALLOC ? r.arg == first_ptr : r.arg),
+                   r.ptr ? "" : " null");
+        }
+    }
+    fclose(f);
+    unlink(fname);
+}
+
+//! site ??{\d+}=s1??: test66.cc:18
+//! op 2 thread 1 site ??s1?? size 100 arg 0
+//! site ??{\d+}=s2??: test66.cc:19
+//! op 4 thread 1 site ??s2?? size 20 arg 3
+//! site ??{\d+}=s3??: test66.cc:20
+//! op 5 thread 1 site ??s3?? size 200 arg 1
+//! site ??{\d+}=s4??: test66.cc:21
+//! op 3 thread 1 site ??s4?? size 0 arg 0
+//! site ??{\d+}=s5??: test66.cc:22
+//! op 3 thread 1 site ??s5?? size 0 arg 0
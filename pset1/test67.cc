@@ -0,0 +1,31 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+// Check `M61_HUGE_PAGES`: big blocks are 2 MiB aligned, and statistics
+// report huge page coverage of the heap.
+
+int main() {
+    setenv("M61_HUGE_PAGES", "1", 1);
+    char* big = (char*) m61_malloc(6 << 20);
+    assert(reinterpret_cast<uintptr_t>(big) % (2 << 20) == 0);
+    memset(big, 1, 6 << 20);
+    void* ptrs[1000];
+    for (int i = 0; i != 1000; ++i) {
+        ptrs[i] = m61_malloc(1000);
+        memset(ptrs[i], 1, 1000);
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.heap_resident >= (6 << 20) + 1000 * 1000);
+    assert(stat.heap_huge <= stat.heap_resident);
+    for (int i = 0; i != 1000; ++i) {
+        m61_free(ptrs[i]);
+    }
+    m61_free(big);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total       1001   fail          0
+//! alloc size:  active          0   total   ??{\d+}??   fail          0
+//! huge pages:  ??{\d+}?? of ??{\d+}?? resident heap bytes (???%)
@@ -0,0 +1,94 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Stress cross-thread frees: each thread sends blocks around a ring of
+// threads, so most blocks are freed by a thread other than their
+// allocator (and some after their allocator has exited).
+
+constexpr int nthreads = 6;
+constexpr int nsend = 40000;
+constexpr size_t qsize = 256;
+
+struct channel {
+    void* slots[qsize];
+    std::atomic<size_t> head = 0;
+    std::atomic<size_t> tail = 0;
+};
+static channel channels[nthreads];  // channels[i]: thread i-1 to thread i
+
+static void fill(unsigned char* p, size_t sz, unsigned tag) {
+    memcpy(p, &sz, sizeof(sz));
+    for (size_t i = sizeof(sz); i < sz; ++i) {
+        p[i] = tag + i;
+    }
+}
+
+static void check(unsigned char* p) {
+    size_t sz;
+    memcpy(&sz, p, sizeof(sz));
+    unsigned tag = p[sizeof(sz)] - sizeof(sz);
+    for (size_t i = sizeof(sz); i < sz; ++i) {
+        assert(p[i] == (unsigned char) (tag + i));
+    }
+}
+
+static bool receive(channel& in) {
+    size_t h = in.head.load(std::memory_order_relaxed);
+    if (in.tail.load(std::memory_order_acquire) == h) {
+        return false;
+    }
+    unsigned char* p = (unsigned char*) in.slots[h % qsize];
+    in.head.store(h + 1, std::memory_order_release);
+    check(p);
+    m61_free(p);
+    return true;
+}
+
+static void ring_thread(int i) {
+    channel& out = channels[(i + 1) % nthreads];
+    channel& in = channels[i];
+    std::minstd_rand randomness(i + 1);
+    int received = 0;
+    for (int n = 0; n != nsend; ++n) {
+        size_t sz = uniform_int(size_t(16), size_t(1000), randomness);
+        unsigned char* p = (unsigned char*) m61_malloc(sz);
+        assert(p);
+        fill(p, sz, n);
+        // A thread-local allocation, interleaved with the remote ones
+        void* q = m61_malloc(sz / 2);
+        size_t t = out.tail.load(std::memory_order_relaxed);
+        while (t - out.head.load(std::memory_order_acquire) == qsize) {
+            received += receive(in);
+            std::this_thread::yield();
+        }
+        out.slots[t % qsize] = p;
+        out.tail.store(t + 1, std::memory_order_release);
+        m61_free(q);
+        received += receive(in);
+    }
+    while (received != nsend) {
+        if (receive(in)) {
+            ++received;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+int main() {
+    std::vector<std::thread> th;
+    for (int i = 0; i != nthreads; ++i) {
+        th.emplace_back(ring_thread, i);
+    }
+    for (auto& t : th) {
+        t.join();
+    }
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total     480000   fail          0
+//! alloc size:  active          0   total ??{\d+}??   fail          0
@@ -0,0 +1,65 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+// Check that statistics snapshots are consistent while one thread frees
+// the blocks another allocates.
+
+constexpr int nsend = 50000;
+constexpr size_t qsize = 16;
+
+static void* slots[qsize];
+static std::atomic<size_t> head = 0;
+static std::atomic<size_t> tail = 0;
+static std::atomic<bool> done;
+
+static void producer_thread() {
+    for (int n = 0; n != nsend; ++n) {
+        void* p = m61_malloc(100);
+        assert(p);
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == qsize) {
+            std::this_thread::yield();
+        }
+        slots[t % qsize] = p;
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+static void consumer_thread() {
+    for (int n = 0; n != nsend; ++n) {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == h) {
+            std::this_thread::yield();
+        }
+        void* p = slots[h % qsize];
+        head.store(h + 1, std::memory_order_release);
+        m61_free(p);
+    }
+}
+
+int main() {
+    std::thread producer(producer_thread);
+    std::thread consumer(consumer_thread);
+    std::thread watcher([] () {
+        while (!done) {
+            // At any moment, at most `qsize` blocks wait in the queue, one
+            // is held by the producer, and one is being freed. A snapshot
+            // that read the two threads' counts at different moments could
+            // see more (or fewer than zero).
+            m61_statistics stat = m61_get_statistics();
+            assert(stat.nactive <= qsize + 2);
+            assert(stat.active_size == 100 * stat.nactive);
+            assert(stat.total_size == 100 * stat.ntotal);
+        }
+    });
+    producer.join();
+    consumer.join();
+    done = true;
+    watcher.join();
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total      50000   fail          0
+//! alloc size:  active          0   total    5000000   fail          0
@@ -0,0 +1,33 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+// Check the capacity of page-aligned large blocks, whose payload starts
+// a page or more into their mapping: all of it can be written, and
+// realloc copies it.
+
+static void check(size_t align, size_t sz) {
+    unsigned char* p = (unsigned char*) m61_aligned_alloc(align, sz);
+    assert(p && reinterpret_cast<uintptr_t>(p) % align == 0);
+    size_t cap = m61_usable_size(p);
+    assert(cap >= sz && cap < sz + 2 * 4096);
+    for (size_t i = 0; i != cap; ++i) {
+        p[i] = i % 251;
+    }
+    p = (unsigned char*) m61_realloc(p, cap + 100000);
+    assert(p);
+    for (size_t i = 0; i != cap; ++i) {
+        assert(p[i] == i % 251);
+    }
+    m61_free(p);
+}
+
+int main() {
+    check(4096, 200000);
+    check(8192, 200000);
+    check(65536, 300000);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          6   fail          0
+//! alloc size:  active          0   total ??{\d+}??   fail          0
@@ -0,0 +1,40 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+// Check `m61_usable_size`: every byte it reports can be written, for
+// small, large, aligned, and huge-page blocks.
+
+static void fill(void* ptr) {
+    size_t cap = m61_usable_size(ptr);
+    memset(ptr, 'x', cap);
+    m61_check_canaries();
+    m61_free(ptr);
+}
+
+int main() {
+    setenv("M61_HUGE_PAGES", "1", 1);
+    assert(m61_usable_size(nullptr) == 0);
+
+    void* p = m61_malloc(10);
+    assert(m61_usable_size(p) >= 10);
+    fill(p);
+    fill(m61_malloc(5000));
+    fill(m61_malloc(200000));
+    fill(m61_aligned_alloc(64, 1000));
+    fill(m61_aligned_alloc(4096, 10000));
+    fill(m61_aligned_alloc(4096, 200000));
+
+    // Huge-page blocks are 2 MiB aligned, so their payload is page aligned
+    p = m61_malloc(4 << 20);
+    assert(reinterpret_cast<uintptr_t>(p) % (2 << 20) == 0);
+    assert(m61_usable_size(p) >= (4 << 20));
+    fill(p);
+    fill(m61_aligned_alloc(4 << 20, 3 << 20));
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          8   fail          0
+//! alloc size:  active          0   total ??{\d+}??   fail          0
+//! huge pages:  ??{\d+}?? of ??{\d+}?? resident heap bytes (???%)
@@ -0,0 +1,51 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+// Check realloc of huge-page blocks, whose payload is 2 MiB aligned: the
+// block's whole capacity survives growing and shrinking.
+
+static void fill(unsigned char* p, size_t n, unsigned seed) {
+    for (size_t i = 0; i != n; ++i) {
+        p[i] = (i * 7 + seed) % 253;
+    }
+}
+
+static void check(const unsigned char* p, size_t n, unsigned seed) {
+    for (size_t i = 0; i != n; ++i) {
+        assert(p[i] == (i * 7 + seed) % 253);
+    }
+}
+
+int main() {
+    setenv("M61_HUGE_PAGES", "1", 1);
+    unsigned char* p = (unsigned char*) m61_malloc(3 << 20);
+    assert(reinterpret_cast<uintptr_t>(p) % (2 << 20) == 0);
+    size_t cap = m61_usable_size(p);
+    fill(p, cap, 1);
+
+    // Grow, then fill the new capacity
+    p = (unsigned char*) m61_realloc(p, 8 << 20);
+    assert(p);
+    check(p, cap, 1);
+    cap = m61_usable_size(p);
+    assert(cap >= (8 << 20));
+    fill(p, cap, 2);
+
+    // Shrink, staying huge
+    p = (unsigned char*) m61_realloc(p, 5 << 20);
+    assert(p);
+    check(p, 5 << 20, 2);
+
+    // Shrink below the huge-page size
+    p = (unsigned char*) m61_realloc(p, 1 << 20);
+    assert(p);
+    check(p, 1 << 20, 2);
+    m61_free(p);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          4   fail          0
+//! alloc size:  active          0   total   ??{\d+}??   fail          0
+//! huge pages:  ??{\d+}?? of ??{\d+}?? resident heap bytes (???%)
@@ -0,0 +1,32 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <thread>
+// Check that blocks freed by another thread while their allocating thread
+// is blocked are not all held for it: most return to the central heap.
+
+constexpr int n = 20000;
+static void* ptrs[n];
+
+int main() {
+    for (int i = 0; i != n; ++i) {
+        ptrs[i] = m61_malloc(100);
+        assert(ptrs[i]);
+    }
+    m61_statistics before = m61_get_statistics();
+
+    // This thread waits, so it never collects its remote-free queue
+    std::thread consumer([] () {
+        for (int i = 0; i != n; ++i) {
+            m61_free(ptrs[i]);
+        }
+    });
+    consumer.join();
+
+    m61_statistics after = m61_get_statistics();
+    assert(after.free_size >= before.free_size + (n / 2) * 100);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total      20000   fail          0
+//! alloc size:  active          0   total    2000000   fail          0
@@ -1,6 +1,7 @@
 #include "io61.hh"
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <ctime>
 #include <csignal>
 #include <cerrno>
 
@@ -1,18 +1,69 @@
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <climits>
 #include <cerrno>
+#include <algorithm>
 
 // io61.cc
-//    YOUR CODE HERE!
+//    A multi-slot cache for io61 files. Each io61_file caches up to
+//    `nslots` regions of its file, so byte and small-block I/O costs one
+//    system call per cache buffer, even when the program interleaves
+//    accesses to several parts of the file. Writes are held until the
+//    slots fill, then written back with adjacent extents combined. Read-only
+//    regular files are memory-mapped instead, so reads and seeks need no
+//    system calls.
+
+
+// io61_slot
+//    One cache slot. cbuf[0] holds the byte at file offset `tag`. Read
+//    slots hold the file bytes at offsets [tag, end_tag); they are clean
+//    copies of file data and may overlap. Write slots hold a dirty extent,
+//    the bytes at offsets [dirty_tag, end_tag), where
+//    tag <= dirty_tag <= end_tag <= tag + cbufsz. Dirty extents never
+//    overlap, so they can be written back in any order.
+
+struct io61_slot {
+    static constexpr off_t cbufsz = 8192;
+    off_t tag = 0;              // file offset of first byte in slot
+    off_t dirty_tag = 0;        // file offset of first dirty byte
+    off_t end_tag = 0;          // file offset one past last valid byte
+    unsigned long long used = 0;  // LRU timestamp
+    unsigned char* cbuf;        // cached data (`cbufsz` bytes)
+};
 
 
 // io61_file
-//    Data structure for io61 file wrappers. Add your own stuff.
+//    Data structure for io61 file wrappers.
+//
+//    `pos_tag` is the file position as seen by the user; `cur` is the
+//    most recently used slot. For read-only files, `fd_tag` is the file
+//    descriptor's position. Write-only seekable files are written with
+//    `pwritev` when not sequential, so seeks need no system calls;
+//    `io61_flush` moves the descriptor to `pos_tag`. For writes,
+//    [low_limit, limit) is the range `cur` can grow into without reaching
+//    another extent.
+//
+//    If `data` is nonnull, the file is memory-mapped: `data` holds its
+//    `size` bytes, `pos_tag` is the read position, and the cache is unused.
 
 struct io61_file {
-    int fd = -1;     // file descriptor
+    int fd = -1;                // file descriptor
+    int mode;                   // O_RDONLY or O_WRONLY
+    bool seekable = false;      // false for pipes and sockets
+    off_t pos_tag = 0;          // file offset of next byte to read/write
+    off_t fd_tag = 0;           // file descriptor's offset
+    off_t low_limit = 0;        // write limits for `cur`
+    off_t limit = 0;
+    static constexpr int nslots = 16;
+    io61_slot slots[nslots];
+    io61_slot* cur = &slots[0]; // most recently used slot
+    unsigned long long clock = 0;  // LRU clock
+    const unsigned char* data = nullptr;  // memory-mapped file contents
+    off_t size = 0;             // size of memory-mapped file
+    alignas(4096) unsigned char cbufs[nslots][io61_slot::cbufsz];
 };
 
 
@@ -25,7 +76,33 @@ io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
-    (void) mode;
+    f->mode = mode & O_ACCMODE;
+    // Offsets track the descriptor's position; pipes start at 0
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    if (off != (off_t) -1) {
+        f->seekable = true;
+        f->pos_tag = f->fd_tag = off;
+    }
+    for (int i = 0; i != f->nslots; ++i) {
+        f->slots[i].tag = f->slots[i].dirty_tag = f->slots[i].end_tag = f->pos_tag;
+        f->slots[i].cbuf = f->cbufs[i];
+    }
+    f->low_limit = f->pos_tag;
+    f->limit = f->pos_tag + io61_slot::cbufsz;
+    // Map regular files for reading; pipes, sockets, and devices (and
+    // files that fail to map) use the cache
+    struct stat s;
+    if (f->mode == O_RDONLY
+        && f->seekable
+        && fstat(fd, &s) == 0
+        && S_ISREG(s.st_mode)
+        && s.st_size > 0) {
+        void* data = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            f->data = (const unsigned char*) data;
+            f->size = s.st_size;
+        }
+    }
     return f;
 }
 
@@ -35,28 +112,114 @@ io61_file* io61_fdopen(int fd, int mode) {
 
 int io61_close(io61_file* f) {
     io61_flush(f);
+    if (f->data) {
+        munmap((void*) f->data, f->size);
+    }
     int r = close(f->fd);
     delete f;
     return r;
 }
 
 
+// io61_use(f, s)
+//    Makes `s` the current slot of `f`.
+
+static inline void io61_use(io61_file* f, io61_slot* s) {
+    s->used = ++f->clock;
+    f->cur = s;
+}
+
+// io61_victim(f)
+//    Returns the least-recently-used slot of `f`.
+
+static io61_slot* io61_victim(io61_file* f) {
+    io61_slot* victim = &f->slots[0];
+    for (auto& s : f->slots) {
+        if (s.used < victim->used) {
+            victim = &s;
+        }
+    }
+    return victim;
+}
+
+
+// io61_fill(f, pos)
+//    Fills the least-recently-used slot of `f` with data that includes
+//    offset `pos` and returns it. A reader moving backwards (just before
+//    the current slot) gets data ending at `pos`; others get data starting
+//    at `pos`. Returns nullptr on end of file (with `errno == 0`) or error.
+
+static io61_slot* io61_fill(io61_file* f, off_t pos) {
+    off_t start = pos;
+    if (f->seekable
+        && pos < f->cur->tag
+        && f->cur->tag - pos <= io61_slot::cbufsz) {
+        start = std::max(pos + 1 - io61_slot::cbufsz, off_t(0));
+    }
+    if (start != f->fd_tag) {
+        // Some devices, such as /dev/zero, report position 0 after any seek
+        if (lseek(f->fd, start, SEEK_SET) == (off_t) -1) {
+            return nullptr;
+        }
+        f->fd_tag = start;
+    }
+    io61_slot* s = io61_victim(f);
+    s->tag = s->end_tag = start;
+    while (s->end_tag <= pos) {
+        ssize_t nr = read(f->fd, &s->cbuf[s->end_tag - s->tag],
+                          io61_slot::cbufsz - (s->end_tag - s->tag));
+        if (nr > 0) {
+            s->end_tag += nr;
+            f->fd_tag += nr;
+        } else if (nr == 0) {
+            errno = 0;
+            return nullptr;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            return nullptr;
+        }
+    }
+    io61_use(f, s);
+    return s;
+}
+
+
+// io61_read_slot(f)
+//    Returns a slot of `f` that caches the byte at `pos_tag`, filling one
+//    if necessary. Returns nullptr on end of file or error.
+
+static io61_slot* io61_read_slot(io61_file* f) {
+    for (auto& s : f->slots) {
+        if (f->pos_tag >= s.tag && f->pos_tag < s.end_tag) {
+            io61_use(f, &s);
+            return &s;
+        }
+    }
+    return io61_fill(f, f->pos_tag);
+}
+
+
 // io61_readc(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
 //    which equals -1, on end of file or error.
 
 int io61_readc(io61_file* f) {
-    unsigned char buf[1];
-    ssize_t nr = read(f->fd, buf, 1);
-    if (nr == 1) {
-        return buf[0];
-    } else if (nr == 0) {
-        errno = 0; // clear `errno` to indicate EOF
-        return -1;
-    } else {
-        assert(nr == -1 && errno > 0);
-        return -1;
+    if (f->data) {
+        if (f->pos_tag >= f->size) {
+            errno = 0;
+            return -1;
+        }
+        return f->data[f->pos_tag++];
     }
+    io61_slot* s = f->cur;
+    if (f->pos_tag < s->tag || f->pos_tag >= s->end_tag) {
+        s = io61_read_slot(f);
+        if (!s) {
+            return -1;
+        }
+    }
+    unsigned char ch = s->cbuf[f->pos_tag - s->tag];
+    ++f->pos_tag;
+    return ch;
 }
 
 
@@ -71,14 +234,41 @@ int io61_readc(io61_file* f) {
 //    This is called a “short read.”
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
+    if (f->data) {
+        size_t n = f->pos_tag < f->size ? std::min(sz, size_t(f->size - f->pos_tag)) : 0;
+        memcpy(buf, &f->data[f->pos_tag], n);
+        f->pos_tag += n;
+        return n;
+    }
     size_t nread = 0;
     while (nread != sz) {
-        int ch = io61_readc(f);
-        if (ch == EOF) {
-            break;
+        io61_slot* s = f->cur;
+        if (f->pos_tag < s->tag || f->pos_tag >= s->end_tag) {
+            if (sz - nread >= (size_t) io61_slot::cbufsz
+                && f->pos_tag == f->fd_tag) {
+                // Large sequential reads bypass the cache
+                ssize_t nr = read(f->fd, &buf[nread], sz - nread);
+                if (nr > 0) {
+                    nread += nr;
+                    f->pos_tag += nr;
+                    f->fd_tag += nr;
+                    continue;
+                } else if (nr == -1 && (errno == EINTR || errno == EAGAIN)) {
+                    continue;
+                } else if (nr == 0) {
+                    errno = 0;
+                }
+                break;
+            }
+            s = io61_read_slot(f);
+            if (!s) {
+                break;
+            }
         }
-        buf[nread] = ch;
-        ++nread;
+        size_t n = std::min(sz - nread, size_t(s->end_tag - f->pos_tag));
+        memcpy(&buf[nread], &s->cbuf[f->pos_tag - s->tag], n);
+        nread += n;
+        f->pos_tag += n;
     }
     if (nread != 0 || sz == 0 || errno == 0) {
         return nread;
@@ -88,19 +278,148 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 }
 
 
+// io61_write_back(f)
+//    Writes all dirty data in `f`'s slots and empties them. Extents that
+//    are adjacent in the file are written together with one `pwritev`
+//    (or `writev`, if the descriptor is already at their start). Returns
+//    0 on success and -1 on error.
+
+static int io61_write_back(io61_file* f) {
+    io61_slot* dirty[io61_file::nslots];
+    int ndirty = 0;
+    for (auto& s : f->slots) {
+        if (s.dirty_tag != s.end_tag) {
+            dirty[ndirty] = &s;
+            ++ndirty;
+        }
+    }
+    std::sort(dirty, dirty + ndirty, [] (io61_slot* a, io61_slot* b) {
+        return a->dirty_tag < b->dirty_tag;
+    });
+    int i = 0;
+    while (i != ndirty) {
+        // Collect a run of adjacent extents
+        iovec iov[io61_file::nslots];
+        int j = i;
+        do {
+            iov[j - i].iov_base = &dirty[j]->cbuf[dirty[j]->dirty_tag - dirty[j]->tag];
+            iov[j - i].iov_len = dirty[j]->end_tag - dirty[j]->dirty_tag;
+            ++j;
+        } while (j != ndirty && dirty[j - 1]->end_tag == dirty[j]->dirty_tag);
+        ssize_t nw;
+        if (!f->seekable || dirty[i]->dirty_tag == f->fd_tag) {
+            nw = writev(f->fd, iov, j - i);
+            if (nw > 0) {
+                f->fd_tag += nw;
+            }
+        } else {
+            nw = pwritev(f->fd, iov, j - i, dirty[i]->dirty_tag);
+        }
+        if (nw == 0 || (nw == -1 && errno != EINTR && errno != EAGAIN)) {
+            return -1;
+        }
+        // Mark written bytes clean; retry the rest of a short write
+        while (nw > 0) {
+            off_t n = std::min(off_t(nw), dirty[i]->end_tag - dirty[i]->dirty_tag);
+            dirty[i]->dirty_tag += n;
+            nw -= n;
+            if (dirty[i]->dirty_tag == dirty[i]->end_tag) {
+                ++i;
+            }
+        }
+    }
+    return 0;
+}
+
+
+// io61_write_slot(f)
+//    Returns a slot of `f` that can accept a write at `pos_tag`, and sets
+//    `f->low_limit` and `f->limit`. Prefers a slot whose dirty extent
+//    holds `pos_tag`, or can grow by one byte to reach it. Otherwise
+//    starts a new extent in the least-recently-used empty slot, writing
+//    back all slots first if none is empty. A new extent just below the
+//    current one is placed at the end of its slot, so a writer moving
+//    backwards fills the whole slot. Returns nullptr on error.
+
+static io61_slot* io61_write_slot(io61_file* f) {
+    off_t pos = f->pos_tag;
+    io61_slot* s = nullptr;
+    for (auto& t : f->slots) {
+        if (pos >= t.dirty_tag && pos < t.end_tag) {
+            s = &t;
+            break;
+        } else if (!s
+                   && ((pos == t.end_tag && pos < t.tag + io61_slot::cbufsz)
+                       || (pos + 1 == t.dirty_tag && pos >= t.tag))) {
+            s = &t;
+        }
+    }
+    if (!s) {
+        bool backwards = pos + 1 == f->cur->dirty_tag;
+        for (auto& t : f->slots) {
+            if (t.dirty_tag == t.end_tag && (!s || t.used < s->used)) {
+                s = &t;
+            }
+        }
+        if (!s) {
+            if (io61_write_back(f) == -1) {
+                return nullptr;
+            }
+            s = io61_victim(f);
+        }
+        if (backwards) {
+            s->tag = std::max(pos + 1 - io61_slot::cbufsz, off_t(0));
+        } else {
+            s->tag = pos;
+        }
+        s->dirty_tag = s->end_tag = pos;
+    }
+    // Never grow into another extent
+    f->low_limit = s->tag;
+    f->limit = s->tag + io61_slot::cbufsz;
+    for (auto& t : f->slots) {
+        if (&t != s && t.dirty_tag != t.end_tag) {
+            if (t.dirty_tag > pos) {
+                f->limit = std::min(f->limit, t.dirty_tag);
+            } else {
+                f->low_limit = std::max(f->low_limit, t.end_tag);
+            }
+        }
+    }
+    io61_use(f, s);
+    return s;
+}
+
+
+// io61_writable(f, s)
+//    Returns true if a write at `pos_tag` can go in slot `s` of `f`
+//    without leaving a gap in its dirty extent.
+
+static inline bool io61_writable(io61_file* f, io61_slot* s) {
+    return f->pos_tag + 1 >= s->dirty_tag
+        && f->pos_tag <= s->end_tag
+        && f->pos_tag >= f->low_limit
+        && f->pos_tag < f->limit;
+}
+
+
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success and
 //    -1 on error.
 
 int io61_writec(io61_file* f, int ch) {
-    unsigned char buf[1];
-    buf[0] = ch;
-    ssize_t nw = write(f->fd, buf, 1);
-    if (nw == 1) {
-        return 0;
-    } else {
-        return -1;
+    io61_slot* s = f->cur;
+    if (!io61_writable(f, s)) {
+        s = io61_write_slot(f);
+        if (!s) {
+            return -1;
+        }
     }
+    s->cbuf[f->pos_tag - s->tag] = ch;
+    s->dirty_tag = std::min(s->dirty_tag, f->pos_tag);
+    ++f->pos_tag;
+    s->end_tag = std::max(s->end_tag, f->pos_tag);
+    return 0;
 }
 
 
@@ -114,10 +433,19 @@ int io61_writec(io61_file* f, int ch) {
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
     size_t nwritten = 0;
     while (nwritten != sz) {
-        if (io61_writec(f, buf[nwritten]) == -1) {
-            break;
+        io61_slot* s = f->cur;
+        if (!io61_writable(f, s)) {
+            s = io61_write_slot(f);
+            if (!s) {
+                break;
+            }
         }
-        ++nwritten;
+        size_t n = std::min(sz - nwritten, size_t(f->limit - f->pos_tag));
+        memcpy(&s->cbuf[f->pos_tag - s->tag], &buf[nwritten], n);
+        nwritten += n;
+        s->dirty_tag = std::min(s->dirty_tag, f->pos_tag);
+        f->pos_tag += n;
+        s->end_tag = std::max(s->end_tag, f->pos_tag);
     }
     if (nwritten != 0 || sz == 0) {
         return nwritten;
@@ -136,7 +464,19 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    drop any data cached for reading.
 
 int io61_flush(io61_file* f) {
-    (void) f;
+    if (f->mode == O_RDONLY) {
+        return 0;
+    }
+    if (io61_write_back(f) == -1) {
+        return -1;
+    }
+    // Leave the descriptor where sequential writes would have
+    if (f->seekable && f->fd_tag != f->pos_tag) {
+        if (lseek(f->fd, f->pos_tag, SEEK_SET) == (off_t) -1) {
+            return -1;
+        }
+        f->fd_tag = f->pos_tag;
+    }
     return 0;
 }
 
@@ -146,12 +486,16 @@ int io61_flush(io61_file* f) {
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t pos) {
-    off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
-    if (r == (off_t) pos) {
-        return 0;
-    } else {
+    if (!f->seekable) {
+        errno = ESPIPE;
+        return -1;
+    } else if (pos < 0) {
+        errno = EINVAL;
         return -1;
     }
+    // Reads and writes find or fill the slot for `pos` when they need it
+    f->pos_tag = pos;
+    return 0;
 }
 
 